@@ -0,0 +1,3 @@
+#include <stdbool.h>
+int main() {
+return 0; }
@@ -4,10 +4,14 @@
 # define LH_TARGET "x64-pc-windows"
 # define LH_ABI_x64
 # define ASM_JMPBUF_SIZE 256
+# define ASM_HAS_SETJMP_LIGHT
+# define ASM_HAS_CALLONSTACK
 #elif _M_IX86
 # define LH_TARGET "x86-pc-windows"
 # define LH_ABI_x86
 # define ASM_JMPBUF_SIZE 36
+# define ASM_HAS_SETJMP_LIGHT
+# define ASM_HAS_CALLONSTACK
 # define ASM_HAS_EXN_FRAMES
 #elif _M_ARM64
 # define LH_TARGET "arm64-pc-windows"
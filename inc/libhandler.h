@@ -190,7 +190,8 @@ typedef enum _lh_opkind {
   LH_OP_TAIL_NOOP, ///< promise to not call `yield` and resume at most once, and if resumed, it is the last action performed by the operation function.
   LH_OP_TAIL,      ///< promise to resume at most once, and if resumed, it is the last action performed by the operation function.
   LH_OP_SCOPED,    ///< promise to never resume, or to always resume within the scope of an operation function.
-  LH_OP_GENERAL    ///< may resume zero, once, or multiple times, and can be resumed outside the scope of the operation function.
+  LH_OP_GENERAL,   ///< may resume zero, once, or multiple times, and can be resumed outside the scope of the operation function.
+  LH_OP_SHALLOW    ///< like #LH_OP_GENERAL but with _shallow_ semantics: the resumption does not include the handler itself, i.e. after resuming operations are handled by outer handlers.
 } lh_opkind;
 
 /// Opereation defintion.
@@ -221,6 +222,21 @@ typedef struct _lh_handlerdef {
 /// Handles operations yielded in `body(arg)` with the given handler definition `def`.
 lh_value lh_handle(const lh_handlerdef* def, lh_value local, lh_actionfun* body, lh_value arg);
 
+/// Handle multiple effects at once.
+/// Equivalent to nesting `n` calls to lh_handle() where `defs[0]` is the outermost handler
+/// and `locals[i]` is the initial local state of `defs[i]` (or #lh_value_null if `locals` is `NULL`).
+/// All handlers share one entry point which is cheaper to set up and uses less C stack than nesting.
+lh_value lh_handle_multi(const lh_handlerdef* const defs[], const lh_value locals[], size_t n, lh_actionfun* body, lh_value arg);
+
+/// Handle an effect like lh_handle() but allocate the resumptions captured by handlers installed 
+/// under it from the caller supplied memory `mem` of `size` bytes; for example, the memory of
+/// a request that is freed in bulk once the request is done. When `mem` is exhausted, memory 
+/// is allocated as usual. Resumptions captured in `mem` should be released before lh_handle_arena() 
+/// returns; if some are still alive at that point an `EFAULT` exception is thrown. Those resumptions 
+/// stay valid and can still be resumed or released, but `mem` must stay valid (and cannot be used for 
+/// another lh_handle_arena()) until they are.
+lh_value lh_handle_arena(void* mem, size_t size, const lh_handlerdef* def, lh_value local, lh_actionfun* body, lh_value arg);
+
 /// Yield an operation to the nearest enclosing handler. 
 lh_value lh_yield(lh_optag optag, lh_value arg);
 
@@ -233,6 +249,78 @@ lh_value lh_yield(lh_optag optag, lh_value arg);
 /// returns the state for the innermost enclosing handler that does not have a `NULL` operation.
 lh_value lh_yield_local(lh_optag optag);
 
+/// A cached reference to the local state of a handler.
+/// Obtained with lh_find_local() and read with lh_local_value().
+typedef struct lh_localref {
+  lh_optag   optag;   ///< The operation used to find the handler.
+  ptrdiff_t  id;      ///< The unique id of the handler; 0 for a default handler.
+  lh_value*  slot;    ///< Pointer to the local state of the handler.
+  ptrdiff_t  epoch;   ///< The handler stack epoch for which `slot` is valid.
+} lh_localref;
+
+/// Return a reference to the local state of the handler lh_yield_local() would return.
+/// The reference stays valid until that handler is popped.
+lh_localref lh_find_local(lh_optag optag);
+
+/// Return the current local state of the handler referred to by `lref`.
+/// This is usually just one load; only if handlers were moved in memory (due to
+/// a reallocation or resumption) the handler is found again and `lref` is updated.
+/// In debug builds it is validated that the handler is still in scope.
+lh_value lh_local_value(lh_localref* lref);
+
+/// Is there an enclosing handler for operation `optag`?
+/// This can be used for optional effects, like logging, where 
+/// there is no need to install a dummy handler. This is fast,
+/// especially if there is no handler.
+bool lh_has_handler(lh_optag optag);
+
+/// Yield an operation to the nearest enclosing handler if there is one.
+/// Returns `false` if there is no handler for `optag` (instead of a fatal error as with lh_yield()).
+/// Otherwise the operation is yielded and its result is stored in `res` (if not `NULL`).
+bool lh_try_yield(lh_optag optag, lh_value arg, lh_value* res);
+
+/*-----------------------------------------------------------------
+  Handler references
+-----------------------------------------------------------------*/
+
+/// A reference to a specific handler instance.
+/// Obtained with lh_find_handler() inside the scope of the handler (e.g. inside the 
+/// action of lh_handle() or the body of an `LH_LINEAR` handler).
+typedef struct lh_handlerref {
+  ptrdiff_t id;     ///< The unique id of the handler; 0 if there was no handler.
+  ptrdiff_t hint;   ///< Where the handler was on the handler stack (for fast lookup).
+} lh_handlerref;
+
+/// Return a reference to the innermost enclosing handler for `effect`.
+/// The `id` field of the reference is 0 if there is no such handler.
+lh_handlerref lh_find_handler(lh_effect effect);
+
+/// Yield an operation directly to the handler referred to by `href`,
+/// bypassing any handlers for the same effect in between.
+/// The handler must still be in scope; this is validated in debug builds.
+/// If the handler does not handle `optag` itself (i.e. it has a `NULL` #lh_opfun)
+/// the operation is forwarded to handlers further down.
+lh_value lh_yield_to(lh_handlerref href, lh_optag optag, lh_value arg);
+
+/*-----------------------------------------------------------------
+  Default handlers
+-----------------------------------------------------------------*/
+
+/// Register a process wide default handler.
+/// A default handler is only used when there is no handler for an operation on the
+/// handler stack, as if it is installed at the bottom of every thread. 
+/// All operations must be #LH_OP_TAIL or #LH_OP_TAIL_NOOP (or have a `NULL` #lh_opfun); 
+/// they are called directly. Any operations performed by an #LH_OP_TAIL operation skip 
+/// all handlers on the handler stack and can only be handled by other default handlers.
+/// The `local` state is shared between threads; an operation should only change it
+/// if that is safe. Any previous default handler for the same effect is unregistered.
+/// Note: the registry itself is not synchronized and should be set up before starting threads.
+void lh_register_default_handler(const lh_handlerdef* hdef, lh_value local);
+
+/// Unregister the default handler for `effect` and release its local state.
+/// Returns `false` if there was no default handler registered.
+bool lh_unregister_default_handler(lh_effect effect);
+
 /*-----------------------------------------------------------------
   Scoped resume
 -----------------------------------------------------------------*/
@@ -260,6 +348,60 @@ lh_value      lh_call_resume(lh_resume r, lh_value local, lh_value res);
 /// Also releases the continuation and it cannot be resumed again!
 lh_value      lh_release_resume(lh_resume r, lh_value local, lh_value res);
 
+/// Resume a first-class continuation of an #LH_OP_SHALLOW operation under a new handler `hdef` 
+/// with initial local state `local`. The new handler is installed in place of the original 
+/// handler and reuses its entry point, so this is as efficient as resuming a deep handler.
+/// Also releases the continuation and it cannot be resumed again!
+lh_value      lh_release_resume_with(lh_resume r, const lh_handlerdef* hdef, lh_value local, lh_value res);
+
+/// Clone a first-class continuation so it can be resumed (or released) independently of `r`,
+/// for example to fork a computation for a parallel search. The clone shares the captured 
+/// C stack frames with `r`; the captured handlers are copied and their local state is 
+/// acquired (and released again when the clone is resumed or released).
+/// Only general (non-scoped) continuations can be cloned. The clone should be released 
+/// with #lh_release or #lh_release_resume.
+lh_resume     lh_resume_clone(lh_resume r);
+
+/// Return the reference count of a first-class continuation (always 1 for tail resumptions).
+ptrdiff_t     lh_resume_refcount(lh_resume r);
+
+/// Information about a live first-class continuation (see lh_enum_resumptions()).
+typedef struct lh_resume_info {
+  lh_resume  resume;         ///< The continuation.
+  ptrdiff_t  refcount;       ///< Its reference count.
+  ptrdiff_t  cstack_size;    ///< Bytes of captured C stack that it owns (also if compressed or spilled).
+  ptrdiff_t  cstack_shared;  ///< Bytes of captured C stack in segments that can be shared with other continuations.
+  ptrdiff_t  hstack_size;    ///< Bytes of captured handler frames.
+  bool       compressed;     ///< Is the captured C stack compressed?
+  bool       spilled;        ///< Is the captured C stack spilled to the spill store?
+} lh_resume_info;
+
+/// Function called by lh_enum_resumptions() for every live continuation; return `false` to stop.
+typedef bool lh_enumfun(const lh_resume_info* info, void* arg);
+
+/// Enumerate the live first-class continuations captured on the current thread, most recently 
+/// captured first. The continuations should not be resumed or released during the enumeration.
+/// Returns the number of continuations that were visited.
+ptrdiff_t     lh_enum_resumptions(lh_enumfun* fun, void* arg);
+
+/// Kinds of roots that libhandler holds (see lh_enum_roots()).
+typedef enum lh_rootkind {
+  LH_ROOT_CSTACK,    ///< Frames of a captured C stack; can contain any pointer at any aligned offset.
+  LH_ROOT_LOCAL      ///< The #lh_value local state of a handler.
+} lh_rootkind;
+
+/// Function called by lh_enum_roots() for every range of memory that can hold roots.
+typedef void lh_rootfun(lh_rootkind kind, const void* start, size_t size, void* arg);
+
+/// Enumerate the memory ranges in the heap where libhandler holds pointers of the current thread,
+/// so a (conservative) garbage collector can scan just those: the captured C stacks of all 
+/// live continuations and fragments, and the local state of every handler on the handler 
+/// stack and in captured continuations. Shared C stack segments (and deduplicated chunks) are 
+/// reported once per call. Compressed or spilled continuations stay that way: their frames are 
+/// reported as a temporary copy that is only valid during the callback. The other ranges are 
+/// valid until a continuation is captured, resumed, or released.
+void          lh_enum_roots(lh_rootfun* fun, void* arg);
+
 
 /*-----------------------------------------------------------------
   Convenience functions for yield
@@ -269,6 +411,9 @@ lh_value      lh_release_resume(lh_resume r, lh_value local, lh_value res);
 /// Inside an operation handler, adjust a pointer that was pointing to the C stack at 
 /// capture time to point inside the now captured stack. This can be used to pass
 /// values by stack reference to operation handlers. Use with care.
+/// If `p` is in frames that are shared with clones (or other captures), the continuation 
+/// first gets its own copy of its captured stack so writes only affect this continuation.
+/// The pointer is valid until the continuation is resumed, cloned, or compressed.
 void* lh_cstack_ptr(lh_resume r, void* p);
 
 /// Convert a C stack pointer to an #lh_value.
@@ -350,6 +495,89 @@ void lh_register_onfatal(lh_fatalfun* onfatal);
 /// Register custom allocation functions
 void lh_register_malloc(lh_mallocfun* malloc, lh_callocfun* calloc, lh_reallocfun* realloc, lh_freefun* free);
 
+/// Kinds of objects that libhandler allocates for continuations (see lh_register_object_alloc()).
+typedef enum lh_objkind {
+  LH_OBJ_RESUME,     ///< First-class resumptions.
+  LH_OBJ_FRAGMENT,   ///< Fragments that save the part of the C stack that is overwritten by a resume.
+  LH_OBJ_CSTACK,     ///< Captured C stack frames (and their segments, deduplicated chunks, and compressed frames).
+  LH_OBJ_HSTACK,     ///< Handler stacks (of threads and captured ones).
+  LH_OBJ_KINDS
+} lh_objkind;
+
+/// Host allocation function for objects of a given kind; `arg` is passed at registration.
+typedef void* lh_objallocfun(lh_objkind kind, size_t size, void* arg);
+
+/// Host finalization function, called when libhandler no longer uses an object allocated by an #lh_objallocfun.
+typedef void  lh_objfreefun(lh_objkind kind, void* p, void* arg);
+
+/// Register host allocation functions for one kind of object, for example to allocate 
+/// continuations in the heap of a language runtime and account for their memory. 
+/// If `free` is `NULL` the host reclaims the objects itself once they are finalized;
+/// use a `NULL` `alloc` to allocate with lh_malloc() again. The `free` function can be called 
+/// while a C stack is restored and should not yield or throw. Objects may be allocated before 
+/// they are initialized and should not be moved. An object is always finalized by the functions 
+/// that were registered when it was allocated, so these can be registered at any time.
+void lh_register_object_alloc(lh_objkind kind, lh_objallocfun* alloc, lh_objfreefun* free, void* arg);
+
+/// Register custom allocation functions for the current thread only; these take precedence
+/// over the functions registered with lh_register_malloc(). Use `NULL` to use those again. 
+/// Memory must be freed on the thread that allocated it. Only register these while no handler 
+/// is installed on the thread and none of its continuations are alive (checked in debug builds).
+void lh_register_thread_malloc(lh_mallocfun* malloc, lh_callocfun* calloc, lh_reallocfun* realloc, lh_freefun* free);
+
+/// Compress the captured C stack of suspended first-class continuations once they are cold,
+/// that is, when `threshold` newer continuations have been captured on the same thread.
+/// Compressed continuations are decompressed transparently when resumed.
+/// Use 0 (the default) to disable compression. Note: a pointer returned from #lh_cstack_ptr 
+/// is no longer valid once its continuation is compressed.
+void lh_set_compress_threshold(long threshold);
+
+/// Spill the captured C stack of suspended first-class continuations to a memory mapped file 
+/// in directory `dir` when the total size of the captured C stacks in memory exceeds `budget` bytes 
+/// (per thread). The least recently suspended continuations are spilled first and are moved back
+/// into memory transparently when resumed. Use `NULL` for `dir` to disable spilling (the default).
+/// Each thread has its own spill file, so a spilled continuation is bound to the thread that 
+/// captured it and must be resumed or released on that thread.
+/// Returns `false` if memory mapped files are not supported on this platform.
+bool lh_set_spill_store(const char* dir, size_t budget);
+
+/// Reserve an arena of `size` bytes for the handler stack and captured stacks of the 
+/// current thread. The arena is mapped at once, backed by transparent huge pages where 
+/// possible, and pre-faulted so capturing a continuation does not incur page faults. 
+/// When the arena is exhausted, memory is allocated as usual. Continuations must be released
+/// on the thread that captured them. Use 0 to release the arena; this fails while memory 
+/// in the arena is still in use. Returns `false` on failure or if arenas are not supported 
+/// on this platform.
+bool lh_reserve_arena(size_t size);
+
+/// Deduplicate the captured C stacks of first-class continuations: identical parts 
+/// at the bottom of captured stacks (like an event loop or dispatcher) are stored only once
+/// and shared between the continuations. Stacks are compared in page sized (4KB) chunks 
+/// so only parts larger than a page are shared. Disabled by default.
+void lh_set_dedup(bool enable);
+
+/// Capture budget policies (see lh_set_capture_budget()).
+typedef enum _lh_budget_policy {
+  LH_BUDGET_THROW,     ///< Throw an `ENOMEM` exception (see lh_try()) from the operation that would capture the continuation.
+  LH_BUDGET_CALLBACK,  ///< Call the budget function and capture anyway.
+  LH_BUDGET_BLOCK      ///< Call the budget function until enough continuations are released;
+                       ///< throws an `ENOMEM` exception if the budget function returns `false`.
+} lh_budget_policy;
+
+/// Type of budget functions, called with the bytes that would be live after the capture, and the budget.
+/// For #LH_BUDGET_BLOCK, it should release (or resume) captured continuations and return `true` to check again.
+typedef bool lh_budgetfun(ptrdiff_t needed, ptrdiff_t budget);
+
+/// Set a budget for the live captured bytes of the first-class continuations of the current thread.
+/// An operation that would capture a continuation beyond the budget applies the `policy`.
+/// Use 0 for `budget` to disable the budget (the default). The current usage is 
+/// reported in the `captured_live` field of lh_get_stats().
+void lh_set_capture_budget(ptrdiff_t budget, lh_budget_policy policy, lh_budgetfun* fun);
+
+/// Enable (the default) or disable the dedicated kernels (AVX2, AVX-512, or NEON) used to copy 
+/// captured C stacks; when disabled, `memcpy` is used. Returns the name of the kernel in use.
+const char* lh_set_copy_kernels(bool enable);
+
 /// Default `malloc`.
 void* lh_malloc(size_t size);
 /// Default `calloc`.
@@ -363,6 +591,40 @@ char* lh_strdup(const char* s);
 /// Default `strndup`.
 char* lh_strndup(const char* s, size_t max);
 
+/// Statistics about continuations (see lh_get_stats()).
+/// The counters are process wide except for `captured_live`, `captured_live_peak`,
+/// `hstack_size`, and `hstack_peak` which are per thread.
+typedef struct lh_stats {
+  long      captured;         ///< Number of captured continuations.
+  long      resumed;          ///< Number of resumed continuations.
+  long      released;         ///< Number of released continuations.
+  ptrdiff_t captured_size;    ///< Total size in bytes of the captured continuations.
+  ptrdiff_t captured_cstack;  ///< Total size in bytes of the captured C stacks.
+  ptrdiff_t captured_copied;  ///< Total bytes of C stack copied when capturing; can be less than `captured_cstack` due to incremental capture.
+  ptrdiff_t captured_shared;  ///< Total bytes of C stack shared with other captured stacks (of multi-shot resumptions).
+  ptrdiff_t captured_deduped; ///< Total bytes of C stack shared with identical captured stacks (see lh_set_dedup()).
+  ptrdiff_t restore_reserved; ///< Total bytes of C stack reserved to restore captured stacks.
+  long      compressed;       ///< Number of compressed cold continuations (see lh_set_compress_threshold()).
+  ptrdiff_t compressed_saved; ///< Total bytes saved by compressing cold continuations.
+  ptrdiff_t captured_live;    ///< Current bytes of the live captured continuations of this thread (see lh_set_capture_budget()).
+  ptrdiff_t captured_live_peak; ///< Peak of `captured_live` of this thread.
+  long      over_budget;      ///< Number of captures that exceeded the capture budget.
+  long      spilled;          ///< Number of continuations spilled to the spill store (see lh_set_spill_store()).
+  ptrdiff_t spilled_size;     ///< Total bytes of C stack spilled to the spill store.
+  ptrdiff_t hstack_size;      ///< Current size in bytes of the handler stack of this thread.
+  ptrdiff_t hstack_peak;      ///< Peak size in bytes of the handler stack of this thread.
+  long      hstack_shrunk;    ///< Number of times a handler stack was shrunk (see lh_hstack_trim()).
+  long      lookup_frames;    ///< Total number of handler frames visited when looking up handlers.
+  long      lookup_cut;       ///< Number of lookups that stopped early as the effect summary of a frame excluded any handler below it.
+} lh_stats;
+
+/// Get statistics about continuations so far.
+void lh_get_stats(lh_stats* stats);
+
+/// Shrink the handler stack of the current thread to fit its current use. The handler stack
+/// is also shrunk automatically when a handler returns and the stack is mostly unused.
+void lh_hstack_trim(void);
+
 #ifdef LH_IN_ENCLAVE
 void lh_print_stats(void* out);
 void lh_check_memory(void* out);
@@ -691,8 +953,166 @@ lh_value _lh_implicit_get(lh_resume r, lh_value local, lh_value arg);
 #define implicit_get(name) \
     lh_yield_local(LH_OPTAG(name,get)) 
 
+/// Return a reference to the current binding of an implicit parameter.
+/// Use implicit_get_ref() to read it cheaply as long as the binding is in scope.
+/// \param name The name of a previously defined implicit parameter.
+#define implicit_ref(name) \
+    lh_find_local(LH_OPTAG(name,get))
+
+/// Get the value of an implicit parameter through a reference obtained with implicit_ref().
+/// \param lref An #lh_localref.
+#define implicit_get_ref(lref) \
+    lh_local_value(&(lref))
+
+/// Register a default value for an implicit parameter that is used when it is not bound.
+/// Use `lh_unregister_default_handler(LH_EFFECT(name))` to remove it again.
+/// \param local The default value of the implicit parameter.
+/// \param name The name of the implicit parameter (previously defined using implicit_define())
+#define implicit_default(local,name) \
+    do { \
+      static const lh_operation _lh_impdef_ops[2] = { { LH_OP_TAIL_NOOP, LH_OPTAG(name,get), &_lh_implicit_get }, { LH_OP_NULL, lh_op_null, NULL } }; \
+      static const lh_handlerdef _lh_impdef_hdef  = { LH_EFFECT(name), NULL, NULL, NULL, _lh_impdef_ops }; \
+      lh_register_default_handler(&_lh_impdef_hdef,local); \
+    } while(0)
+
 /// \} implicits
 
+/*-----------------------------------------------------------------
+  State cells:
+  {using_cell(name,value){ ... }}
+-----------------------------------------------------------------*/
+
+lh_value _lh_cell_get(lh_resume r, lh_value local, lh_value arg);
+
+#define LH_CELL_EXIT(after,init,name) \
+    lh_value _lh_cell_##name = (init); \
+    static const lh_operation _lh_cell_ops[2] = { { LH_OP_TAIL_NOOP, LH_OPTAG(name,cell), &_lh_cell_get }, { LH_OP_NULL, lh_op_null, NULL } }; \
+    static const lh_handlerdef _lh_cell_hdef  = { LH_EFFECT(name), NULL, NULL, NULL, _lh_cell_ops }; \
+    LH_LINEAR_EXIT(&_lh_cell_hdef,lh_value_any_ptr(&_lh_cell_##name),false,after)
+
+/// \defgroup effect_cell State Cells
+/// Mutable state that can be read and written directly through a pointer.
+///
+/// The cell is stored on the C stack in the scope of its handler. When a continuation
+/// that includes the scope is captured, the cell is captured with it, and every resumption
+/// restores the cell as it was at capture time. This gives the same semantics for 
+/// multi-shot resumptions as a state handler that copies its local state in the
+/// acquire function, but without allocation or operations for each access.
+///
+/// \b Example
+/// ```
+/// cell_define(counter);
+///
+/// void count_down() {
+///   lh_value* n = cell_ptr(counter);
+///   while (lh_int_value(*n) > 0) *n = lh_value_int(lh_int_value(*n) - 1);
+/// }
+///
+/// void foo() {
+///   {using_cell(lh_value_int(10),counter){
+///     count_down();
+///   }}
+/// }
+/// ```
+/// \{
+
+/// Bind a new state cell in a scope.
+/// \param init  The initial value of the cell.
+/// \param name  The name of the cell (previously defined using cell_define()).
+///
+/// `using_cell` always needs a scope with double braces.
+#define using_cell(init,name) \
+    LH_CELL_EXIT(lh_nothing(),init,name)
+
+/// Define a new state cell.
+/// \param name  The name of the state cell.
+#define cell_define(name) \
+    LH_DEFINE_EFFECT1(name,cell)
+
+/// Declare a new state cell.
+/// This can be used in header files. There must be a corresponding cell_define() too.
+#define cell_declare(name) \
+    LH_DECLARE_EFFECT1(name,cell) LH_DECLARE_OP(name,cell)
+
+/// Get a pointer to the innermost enclosing state cell.
+/// The pointer can be used for direct reads and writes as long as the cell is in scope,
+/// also after resuming a captured continuation.
+/// \param name The name of a previously defined state cell.
+#define cell_ptr(name) \
+    ((lh_value*)lh_ptr_value(lh_yield_local(LH_OPTAG(name,cell))))
+
+/// Get the current value of a state cell.
+#define cell_get(name) \
+    (*cell_ptr(name))
+
+/// Set the value of a state cell.
+#define cell_put(name,value) \
+    (*cell_ptr(name) = (value))
+
+/// \} cells
+
+/*-----------------------------------------------------------------
+  Regions:
+  {using_region(size){ ... }}
+-----------------------------------------------------------------*/
+
+/// A region of memory that is freed at once.
+typedef struct _lh_region lh_region;
+
+LH_DECLARE_EFFECT1(lh_region, alloc)
+extern const lh_handlerdef _lh_region_hdef;
+lh_value _lh_region_create(size_t size);
+
+#define LH_REGION_EXIT(after,size) \
+    LH_LINEAR_EXIT(&_lh_region_hdef,_lh_region_create(size),true,after)
+
+/// \defgroup effect_region Regions
+/// Bump pointer allocation from memory that is freed when the scope of the region exits,
+/// either normally or by an exception.
+///
+/// When a continuation that includes the scope is captured, the region is kept alive 
+/// until the scope has exited and the last resumption that refers to it is released; 
+/// resuming more than once is fine but each resumption allocates its own fresh memory.
+///
+/// \b Example
+/// ```
+/// void handle_request(const char* path) {
+///   {using_region(0){
+///     char* p = lh_region_strdup(path);
+///     ...
+///   }}  // all memory allocated in the region is freed here
+/// }
+/// ```
+/// \{
+
+/// Allocate from a new region in a scope; regions can be nested.
+/// \param size  The size of the first chunk of the region (or 0 for the default).
+///
+/// `using_region` always needs a scope with double braces.
+#define using_region(size) \
+    LH_REGION_EXIT(lh_nothing(),size)
+
+/// Return the innermost enclosing region.
+/// The region stays valid as long as its scope is active.
+lh_region* lh_region_current(void);
+
+/// Allocate `size` bytes (16-byte aligned) in a region. Throws `ENOMEM` when out of memory.
+void* lh_region_alloc_in(lh_region* region, size_t size);
+
+/// Allocate `size` bytes in the innermost enclosing region. Throws `ENOMEM` when out of memory.
+void* lh_region_alloc(size_t size);
+
+/// Allocate `n` zero-initialized elements of `size` bytes in the innermost enclosing region.
+void* lh_region_calloc(size_t n, size_t size);
+
+/// Copy a string into the innermost enclosing region.
+char* lh_region_strdup(const char* s);
+
+/// Return the total number of bytes allocated in a region.
+size_t lh_region_allocated(const lh_region* region);
+
+/// \} regions
+
 /*-----------------------------------------------------------------
   Standard exceptions
 -----------------------------------------------------------------*/
@@ -33,6 +33,10 @@ jump_buf layout (compatible with FreeBSD):
    add these labels too so the linker can resolve it. */
 .global __lh_setjmp
 .global __lh_longjmp
+.global __lh_get_sp
+.global __lh_setjmp_light
+.global __lh_longjmp_light
+.global __lh_callonstack
 
 __lh_setjmp:
 _lh_setjmp:                 /* rdi: jmp_buf */
@@ -76,3 +80,69 @@ _lh_longjmp:                  /* rdi: jmp_buf, rsi: arg */
 ok:
   movq  16 (%rdi), %rsp       /* restore the stack pointer */
   jmpq *(%rdi)                /* and jump to rip */
+
+
+/* void* get_sp()
+ Return the stack pointer of the caller (just above the return address).
+*/
+.global _lh_get_sp
+__lh_get_sp:
+_lh_get_sp:
+  leaq    8 (%rsp), %rax
+  ret
+
+
+/* Light versions that only save and restore the general purpose registers
+   but not the fpu and sse control words; used for handler entry points.
+*/
+.global _lh_setjmp_light
+.global _lh_longjmp_light
+
+__lh_setjmp_light:
+_lh_setjmp_light:           /* rdi: jmp_buf */
+  movq    (%rsp), %rax      /* rip: return address is on the stack */
+  movq    %rax, 0 (%rdi)
+
+  leaq    8 (%rsp), %rax    /* rsp - return address */
+  movq    %rax, 16 (%rdi)
+
+  movq    %rbx,  8 (%rdi)   /* save registers */
+  movq    %rbp, 24 (%rdi)
+  movq    %r12, 32 (%rdi)
+  movq    %r13, 40 (%rdi)
+  movq    %r14, 48 (%rdi)
+  movq    %r15, 56 (%rdi)
+
+  xor     %rax, %rax         /* return 0 */
+  ret
+
+__lh_longjmp_light:
+_lh_longjmp_light:            /* rdi: jmp_buf, rsi: arg */
+  movq  %rsi, %rax            /* return arg to rax */
+
+  movq   8 (%rdi), %rbx       /* restore registers */
+  movq  24 (%rdi), %rbp
+  movq  32 (%rdi), %r12
+  movq  40 (%rdi), %r13
+  movq  48 (%rdi), %r14
+  movq  56 (%rdi), %r15
+
+  testl %eax, %eax            /* longjmp should never return 0 */
+  jnz   ok_light
+  incl  %eax
+ok_light:
+  movq  16 (%rdi), %rsp       /* restore the stack pointer */
+  jmpq *(%rdi)                /* and jump to rip */
+
+
+/* void callonstack(void* sp, void (*fun)(void*), void* arg)
+ Switch the stack pointer to `sp` (16-byte aligned) and call `fun(arg)`; 
+ `fun` never returns.
+*/
+.global _lh_callonstack
+__lh_callonstack:
+_lh_callonstack:              /* rdi: sp, rsi: fun, rdx: arg */
+  movq    %rdi, %rsp
+  movq    %rdx, %rdi
+  callq   *%rsi
+  ud2
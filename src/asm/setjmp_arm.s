@@ -35,6 +35,14 @@
 .global _lh_longjmp
 .type _lh_setjmp,%function
 .type _lh_longjmp,%function
+.global _lh_get_sp
+.type _lh_get_sp,%function
+.global _lh_setjmp_light
+.global _lh_longjmp_light
+.type _lh_setjmp_light,%function
+.type _lh_longjmp_light,%function
+.global _lh_callonstack
+.type _lh_callonstack,%function
 
 
 /* setjmp: r0 points to the jmp_buf */
@@ -65,3 +73,46 @@ _lh_longjmp:
     it      eq
     moveq   r0,   #1
     bx      lr
+
+
+/* get_sp: return the stack pointer of the caller */
+_lh_get_sp:
+    mov     r0, sp
+    bx      lr
+
+
+/* Light versions that do not save and restore the fp control word; used for 
+   handler entry points. The fp registers d8-d15 are callee-saved and must
+   still be saved.
+*/
+_lh_setjmp_light:
+    stmia   r0!, {r4-r12}
+    str     r13, [r0], #4   /* sp */
+    str     r14, [r0], #4   /* lr */
+    add     r0, r0, #4      /* skip fp control */
+    /* store fp registers */
+    vstmia  r0!, {d8-d15}
+    /* return 0 */
+    mov     r0, #0
+    bx      lr
+
+_lh_longjmp_light:
+    ldmia   r0!, {r4-r12}
+    ldr     r13, [r0], #4
+    ldr     r14, [r0], #4
+    add     r0, r0, #4      /* skip fp control */
+    /* restore fp registers */
+    vldmia  r0!, {d8-d15}
+    /* never return zero */
+    movs    r0,   r1      
+    it      eq
+    moveq   r0,   #1
+    bx      lr
+
+
+/* callonstack: switch to stack r0 and call r1 with argument r2; never returns */
+_lh_callonstack:
+    mov     sp, r0
+    mov     r0, r2
+    blx     r1
+    b       .
@@ -45,6 +45,14 @@ jump_buf layout:
 .global _lh_longjmp
 .type _lh_setjmp,%function
 .type _lh_longjmp,%function
+.global _lh_get_sp
+.type _lh_get_sp,%function
+.global _lh_setjmp_light
+.global _lh_longjmp_light
+.type _lh_setjmp_light,%function
+.type _lh_longjmp_light,%function
+.global _lh_callonstack
+.type _lh_callonstack,%function
 
 /* called with x0: &jmp_buf */
 _lh_setjmp:                 
@@ -94,3 +102,60 @@ _lh_longjmp:
     cmp   w1, #0
     cinc  w0, w1, eq
     ret                         /* jump to lr */
+
+
+/* get_sp: return the stack pointer of the caller */
+_lh_get_sp:
+    mov   x0, sp
+    ret
+
+
+/* Light versions that do not save and restore the fp control and status registers;
+   used for handler entry points. The bottom 64 bits of the fp registers d8-d15 are 
+   callee-saved and must still be saved.
+*/
+_lh_setjmp_light:                 
+    stp   x18, x19, [x0], #16
+    stp   x20, x21, [x0], #16
+    stp   x22, x23, [x0], #16
+    stp   x24, x25, [x0], #16
+    stp   x26, x27, [x0], #16
+    stp   x28, x29, [x0], #16   /* x28 and fp */
+    mov   x10, sp               /* sp to x10 */
+    stp   x30, x10, [x0], #32   /* lr and sp, and skip fpcr and fpsr */
+    /* store float registers */
+    stp   d8,  d9,  [x0], #16
+    stp   d10, d11, [x0], #16
+    stp   d12, d13, [x0], #16
+    stp   d14, d15, [x0], #16
+    /* always return zero */
+    mov   x0, #0
+    ret                         /* jump to lr */
+
+_lh_longjmp_light:                  
+    ldp   x18, x19, [x0], #16
+    ldp   x20, x21, [x0], #16
+    ldp   x22, x23, [x0], #16
+    ldp   x24, x25, [x0], #16
+    ldp   x26, x27, [x0], #16
+    ldp   x28, x29, [x0], #16   /* x28 and fp */
+    ldp   x30, x10, [x0], #32   /* lr and sp, and skip fpcr and fpsr */
+    mov   sp,  x10
+    /* restore float registers */
+    ldp   d8,  d9,  [x0], #16
+    ldp   d10, d11, [x0], #16
+    ldp   d12, d13, [x0], #16
+    ldp   d14, d15, [x0], #16
+    /* never return zero */
+    mov   x0, x1
+    cmp   w1, #0
+    cinc  w0, w1, eq
+    ret                         /* jump to lr */
+
+
+/* callonstack: switch to stack x0 and call x1 with argument x2; never returns */
+_lh_callonstack:
+    mov   sp, x0
+    mov   x0, x2
+    blr   x1
+    brk   #0
@@ -80,3 +80,67 @@ _lh_longjmp:
 ok:
   movq  16 (%edi), %rsp       /* restore the stack pointer */     
   jmpl *(%edi)                /* and jump to eip  */
+
+
+/* void* get_sp()
+ Return the stack pointer of the caller (just above the return address).
+*/
+.global _lh_get_sp
+_lh_get_sp:
+  leaq    4 (%rsp), %rax
+  ret
+
+
+/* Light versions that only save and restore the general purpose registers
+   but not the fpu and sse control words; used for handler entry points.
+*/
+.global _lh_setjmp_light
+.global _lh_longjmp_light
+
+_lh_setjmp_light:           /* rdi: jmp_buf */
+  xorl    %rax, %rax
+  movl    (%esp), %eax      /* eip: return address is on the stack */
+  movq    %rax, 0 (%edi)    
+
+  leaq    4 (%rsp), %rax    /* rsp - return address */
+  movq    %rax, 16 (%edi)   
+
+  movq    %rbx,  8 (%edi)   /* save registers */
+  movq    %rbp, 24 (%edi) 
+  movq    %r12, 32 (%edi) 
+  movq    %r13, 40 (%edi) 
+  movq    %r14, 48 (%edi) 
+  movq    %r15, 56 (%edi) 
+
+  xor     %rax, %rax         /* return 0 */
+  ret
+
+_lh_longjmp_light:                  
+  movq  %rsi, %rax            /* return arg to rax */
+  
+  movq   8 (%edi), %rbx       /* restore registers */
+  movq  24 (%edi), %rbp
+  movq  32 (%edi), %r12
+  movq  40 (%edi), %r13
+  movq  48 (%edi), %r14
+  movq  56 (%edi), %r15
+
+  testl %eax, %eax            /* longjmp should never return 0 */ 
+  jnz   ok_light
+  incl  %eax
+ok_light:
+  movq  16 (%edi), %rsp       /* restore the stack pointer */     
+  jmpl *(%edi)                /* and jump to eip  */
+
+
+/* void callonstack(void* sp, void (*fun)(void*), void* arg)
+ Switch the stack pointer to `sp` (16-byte aligned) and call `fun(arg)`; 
+ `fun` never returns.
+*/
+.global _lh_callonstack
+_lh_callonstack:              /* edi: sp, esi: fun, edx: arg */
+  movl    %edi, %esp
+  movl    %edx, %edi
+  movl    %esi, %esi
+  callq   *%rsi
+  ud2
@@ -114,4 +114,89 @@ ok:
 
 _lh_longjmp ENDP
 
+; void* get_sp()
+; Return the stack pointer of the caller (just above the return address).
+_lh_get_sp PROC
+  lea     rax, [rsp+8]
+  ret
+_lh_get_sp ENDP
+
+; Light versions that do not save and restore the fpu and sse control words;
+; used for handler entry points. The sse registers xmm6-15 are callee-saved
+; and must still be saved.
+_lh_setjmp_light PROC
+  mov     rax, [rsp]       ; rip: save the return address
+  mov     [rcx+80], rax      
+
+  lea     rax, [rsp+8]     ; save rsp (minus return address)
+  mov     [rcx+16], rax
+
+  mov     [rcx+ 0], edx    ; save registers
+  mov     [rcx+ 8], rbx    
+  mov     [rcx+24], rbp
+  mov     [rcx+32], rsi
+  mov     [rcx+40], rdi
+  mov     [rcx+48], r12
+  mov     [rcx+56], r13
+  mov     [rcx+64], r14
+  mov     [rcx+72], r15
+  
+  movdqu  [rcx+96],  xmm6  ; save sse registers
+  movdqu  [rcx+112], xmm7
+  movdqu  [rcx+128], xmm8
+  movdqu  [rcx+144], xmm9 
+  movdqu  [rcx+160], xmm10
+  movdqu  [rcx+176], xmm11
+  movdqu  [rcx+192], xmm12
+  movdqu  [rcx+208], xmm13
+  movdqu  [rcx+224], xmm14
+  movdqu  [rcx+240], xmm15
+  
+  xor     eax, eax
+  ret
+
+_lh_setjmp_light ENDP
+
+_lh_longjmp_light PROC
+  mov     eax, edx              ; set rax to the return value (arg)
+    
+  mov     rdx,   [rcx+ 0]       ; restore registers
+  mov     rbx,   [rcx+ 8]
+  mov     rbp,   [rcx+24]
+  mov     rsi,   [rcx+32]
+  mov     rdi,   [rcx+40]
+  mov     r12,   [rcx+48]
+  mov     r13,   [rcx+56]
+  mov     r14,   [rcx+64]
+  mov     r15,   [rcx+72]
+  
+  movdqu  xmm6,  [rcx+96]       ; restore sse registers
+  movdqu  xmm7,  [rcx+112]
+  movdqu  xmm8,  [rcx+128]
+  movdqu  xmm9,  [rcx+144]
+  movdqu  xmm10, [rcx+160]
+  movdqu  xmm11, [rcx+176]
+  movdqu  xmm12, [rcx+192]
+  movdqu  xmm13, [rcx+208]
+  movdqu  xmm14, [rcx+224]
+  movdqu  xmm15, [rcx+240]
+   
+  test    eax, eax              ; longjmp should never return 0
+  jnz     ok_light
+  inc     eax
+ok_light:
+  mov     rsp, [rcx+16]         ; restore rsp
+  jmp     qword ptr [rcx+80]    ; and jump to the rip
+
+_lh_longjmp_light ENDP
+
+; void callonstack(void* sp, void (*fun)(void*), void* arg)
+; Switch the stack pointer to `sp` (16-byte aligned) and call `fun(arg)`; `fun` never returns.
+_lh_callonstack PROC
+  lea     rsp, [rcx-32]         ; reserve the shadow space
+  mov     rcx, r8
+  call    rdx
+  ud2
+_lh_callonstack ENDP
+
 END 
\ No newline at end of file
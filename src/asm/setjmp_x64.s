@@ -38,6 +38,10 @@ jump_buf layout (compatible with msvc):
    add these labels too so the linker can resolve it. */
 .global __lh_setjmp
 .global __lh_longjmp
+.global __lh_get_sp
+.global __lh_setjmp_light
+.global __lh_longjmp_light
+.global __lh_callonstack
 
 /* called with jmp_buf at sp+4 */
 __lh_setjmp:
@@ -110,3 +114,98 @@ _lh_longjmp:                  /* rcx: jmp_buf, edx: arg */
 ok:
   movq  16 (%rcx), %rsp        /* set the stack frame */
   jmpq *80 (%rcx)              /* and jump to rip */
+
+
+/* void* get_sp()
+ Return the stack pointer of the caller (just above the return address).
+*/
+.global _lh_get_sp
+__lh_get_sp:
+_lh_get_sp:
+  leaq    8 (%rsp), %rax
+  ret
+
+
+/* Light versions that do not save and restore the fpu and sse control words; 
+   used for handler entry points. The sse registers xmm6-15 are callee-saved
+   and must still be saved.
+*/
+.global _lh_setjmp_light
+.global _lh_longjmp_light
+
+__lh_setjmp_light:
+_lh_setjmp_light:           /* input: rcx: jmp_buf, rdx: frame pointer */
+  movq    (%rsp), %rax      /* return address is on the stack */
+  movq    %rax, 80 (%rcx)   /* rip */
+
+  leaq    8 (%rsp), %rax
+  movq    %rax, 16 (%rcx)   /* rsp: just from before the return address */
+
+  movq    %rdx,  0 (%rcx)   /* save registers */
+  movq    %rbx,  8 (%rcx)
+  movq    %rbp, 24 (%rcx)
+  movq    %rsi, 32 (%rcx)
+  movq    %rdi, 40 (%rcx)
+  movq    %r12, 48 (%rcx)
+  movq    %r13, 56 (%rcx)
+  movq    %r14, 64 (%rcx)
+  movq    %r15, 72 (%rcx)
+
+  movdqu  %xmm6,   96 (%rcx) /* save sse registers */
+  movdqu  %xmm7,  112 (%rcx)
+  movdqu  %xmm8,  128 (%rcx)
+  movdqu  %xmm9,  144 (%rcx)
+  movdqu  %xmm10, 160 (%rcx)
+  movdqu  %xmm11, 176 (%rcx)
+  movdqu  %xmm12, 192 (%rcx)
+  movdqu  %xmm13, 208 (%rcx)
+  movdqu  %xmm14, 224 (%rcx)
+  movdqu  %xmm15, 240 (%rcx)
+
+  xor     %rax, %rax          /* return 0 */
+  ret
+
+__lh_longjmp_light:
+_lh_longjmp_light:            /* rcx: jmp_buf, edx: arg */
+  movq  %rdx, %rax            /* return arg to rax */
+
+  movq   0 (%rcx), %rdx       /* restore registers */
+  movq   8 (%rcx), %rbx
+  movq  24 (%rcx), %rbp
+  movq  32 (%rcx), %rsi
+  movq  40 (%rcx), %rdi
+  movq  48 (%rcx), %r12
+  movq  56 (%rcx), %r13
+  movq  64 (%rcx), %r14
+  movq  72 (%rcx), %r15
+
+  movdqu   96 (%rcx), %xmm6   /* restore sse registers */
+  movdqu  112 (%rcx), %xmm7
+  movdqu  128 (%rcx), %xmm8
+  movdqu  144 (%rcx), %xmm9
+  movdqu  160 (%rcx), %xmm10
+  movdqu  176 (%rcx), %xmm11
+  movdqu  192 (%rcx), %xmm12
+  movdqu  208 (%rcx), %xmm13
+  movdqu  224 (%rcx), %xmm14
+  movdqu  240 (%rcx), %xmm15
+
+  testl %eax, %eax            /* longjmp should never return 0 */
+  jnz   ok_light
+  incl  %eax
+ok_light:
+  movq  16 (%rcx), %rsp        /* set the stack frame */
+  jmpq *80 (%rcx)              /* and jump to rip */
+
+
+/* void callonstack(void* sp, void (*fun)(void*), void* arg)
+ Switch the stack pointer to `sp` (16-byte aligned) and call `fun(arg)`; 
+ `fun` never returns.
+*/
+.global _lh_callonstack
+__lh_callonstack:
+_lh_callonstack:              /* rcx: sp, rdx: fun, r8: arg */
+  leaq    -32 (%rcx), %rsp    /* reserve the shadow space */
+  movq    %r8, %rcx
+  callq   *%rdx
+  ud2
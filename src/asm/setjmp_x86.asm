@@ -96,4 +96,68 @@ _lh_get_exn_top PROC
 _lh_get_exn_top ENDP
 
 
+; void* get_sp()
+; Return the stack pointer of the caller (just above the return address).
+_lh_get_sp PROC
+  lea     eax, [esp+4]
+  ret
+_lh_get_sp ENDP
+
+; Light versions that do not save and restore the fpu and sse control words;
+; used for handler entry points.
+_lh_setjmp_light PROC
+  mov     ecx, [esp+4]     ; jmp_buf to ecx
+  mov     eax, [esp]       ; eip: save the return address
+  mov     [ecx+20], eax      
+
+  lea     eax, [esp+4]     ; save esp (minus return address)
+  mov     [ecx+16], eax
+
+  mov     [ecx+ 0], ebp    ; save registers
+  mov     [ecx+ 4], ebx    
+  mov     [ecx+ 8], edi
+  mov     [ecx+12], esi
+  
+  mov     eax, fs:[0]      ; save exception top frame
+  mov     [ecx+32], eax
+    
+  xor     eax, eax         ; return zero
+  ret
+
+_lh_setjmp_light ENDP
+
+_lh_longjmp_light PROC
+  mov     eax, [esp+8]        ; set eax to the return value (arg)
+  mov     ecx, [esp+4]        ; ecx to jmp_buf
+  
+  mov     ebx, [ecx+32]       ; restore the exception handler top frame
+  mov     fs:[0], ebx 
+
+  mov     ebp, [ecx+ 0]       ; restore registers
+  mov     ebx, [ecx+ 4]
+  mov     edi, [ecx+ 8]
+  mov     esi, [ecx+12]
+  
+  test    eax, eax            ; longjmp should never return 0
+  jnz     ok_light
+  inc     eax
+ok_light:
+  mov     esp, [ecx+16]       ; restore esp
+  jmp     dword ptr [ecx+20]  ; and jump to the eip
+
+_lh_longjmp_light ENDP
+
+; void callonstack(void* sp, void (*fun)(void*), void* arg)
+; Switch the stack pointer to `sp` (16-byte aligned) and call `fun(arg)`; `fun` never returns.
+_lh_callonstack PROC
+  mov     ecx, [esp+4]        ; sp
+  mov     eax, [esp+8]        ; fun
+  mov     edx, [esp+12]       ; arg
+  mov     esp, ecx
+  sub     esp, 12             ; keep the stack 16-byte aligned at the call
+  push    edx
+  call    eax
+  ud2
+_lh_callonstack ENDP
+
 END 
\ No newline at end of file
@@ -32,6 +32,10 @@ jump_buf layout, somewhat compatible with msvc
 .global __lh_setjmp
 .global __lh_longjmp
 .global __lh_get_exn_top
+.global __lh_get_sp
+.global __lh_setjmp_light
+.global __lh_longjmp_light
+.global __lh_callonstack
 
 /* called with jmp_buf at sp+4 */
 __lh_setjmp:
@@ -91,3 +95,77 @@ __lh_get_exn_top:
 _lh_get_exn_top:
   mov     %fs:0, %eax
   ret
+
+
+/* void* get_sp()
+ Return the stack pointer of the caller (just above the return address).
+*/
+.global _lh_get_sp
+__lh_get_sp:
+_lh_get_sp:
+  leal    4 (%esp), %eax
+  ret
+
+
+/* Light versions that do not save and restore the fpu and sse control words; 
+   used for handler entry points.
+*/
+.global _lh_setjmp_light
+.global _lh_longjmp_light
+
+__lh_setjmp_light:
+_lh_setjmp_light:
+  movl    4 (%esp), %ecx   /* jmp_buf to ecx  */
+  movl    0 (%esp), %eax   /* eip: save the return address */
+  movl    %eax, 20 (%ecx)  
+
+  leal    4 (%esp), %eax   /* save esp (minus return address) */
+  movl    %eax, 16 (%ecx)  
+
+  movl    %ebp,  0 (%ecx)  /* save registers */
+  movl    %ebx,  4 (%ecx)
+  movl    %edi,  8 (%ecx)
+  movl    %esi, 12 (%ecx)
+
+  movl    %fs:0, %eax      /* save registration node (exception handling frame top) */
+  movl    %eax, 32 (%ecx)
+    
+  xorl    %eax, %eax       /* return zero */
+  ret
+
+__lh_longjmp_light:
+_lh_longjmp_light:
+  movl    8 (%esp), %eax      /* set eax to the return value (arg) */
+  movl    4 (%esp), %ecx      /* set ecx to jmp_buf */
+
+  movl    32 (%ecx), %ebx     /* restore registration node (exception handling frame top) */
+  movl    %ebx, %fs:0
+  
+  movl    0 (%ecx), %ebp      /* restore registers */
+  movl    4 (%ecx), %ebx
+  movl    8 (%ecx), %edi
+  movl    12 (%ecx), %esi
+
+  testl   %eax, %eax          /* longjmp should never return 0 */
+  jnz     ok_light
+  incl    %eax
+ok_light:
+  movl    16 (%ecx), %esp     /* restore esp */
+  jmpl    *20 (%ecx)          /* and jump to the eip */
+
+
+/* void callonstack(void* sp, void (*fun)(void*), void* arg)
+ Switch the stack pointer to `sp` (16-byte aligned) and call `fun(arg)`; 
+ `fun` never returns.
+*/
+.global _lh_callonstack
+__lh_callonstack:
+_lh_callonstack:
+  movl    4 (%esp), %ecx      /* sp */
+  movl    8 (%esp), %eax      /* fun */
+  movl    12 (%esp), %edx     /* arg */
+  movl    %ecx, %esp
+  subl    $12, %esp           /* keep the stack 16-byte aligned at the call */
+  pushl   %edx
+  call    *%eax
+  ud2
@@ -37,6 +37,11 @@
       be jumped to.
 -----------------------------------------------------------------------------*/
 
+#if !defined(_WIN32) && !defined(_XOPEN_SOURCE)
+#define _XOPEN_SOURCE 700  // mkstemp and ftruncate for the spill store
+#define _DEFAULT_SOURCE    // MAP_ANONYMOUS and madvise for the arena
+#endif
+
 #ifdef __cplusplus
 #include <exception>
 #include <utility>
@@ -55,6 +60,20 @@
 #include <setjmp.h>   // jmpbuf
 #include <assert.h>   // assert
 #include <errno.h>    
+#ifdef HAS_MMAP
+#include <sys/mman.h> // mmap
+#include <unistd.h>   // ftruncate, unlink
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LH_COPY_X64
+#include <immintrin.h> // avx2, avx512 copy kernels
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define LH_COPY_NEON
+#include <arm_neon.h>  // neon copy kernel
+#endif
 
 // maintain cheap statistics
 #define _STATS
@@ -96,6 +115,7 @@
 typedef void* lh_jmp_buf[ASM_JMPBUF_SIZE/sizeof(void*)];
 __externc __returnstwice int  _lh_setjmp(lh_jmp_buf buf);
 __externc __noreturn     void _lh_longjmp(lh_jmp_buf buf, int arg);
+__externc void*                _lh_get_sp(void);
 
 #elif defined(HAS__SETJMP)
 # define lh_jmp_buf   jmp_buf
@@ -117,6 +137,23 @@ __externc __noreturn     void _lh_longjmp(lh_jmp_buf buf, int arg);
 # error "setjmp not found!"
 #endif
 
+// Handler entry points are only ever jumped to by yielding to the handler and do not need
+// the full floating point context; some assembly versions provide a lighter setjmp/longjmp 
+// for this that does not save and restore the fpu and sse control words.
+#if defined(ASM_HAS_SETJMP_LIGHT)
+__externc __returnstwice int  _lh_setjmp_light(lh_jmp_buf buf);
+__externc __noreturn     void _lh_longjmp_light(lh_jmp_buf buf, int arg);
+#else
+# define _lh_setjmp_light   _lh_setjmp
+# define _lh_longjmp_light  _lh_longjmp
+#endif
+
+// Some assembly versions can switch to another stack to call a function; this is 
+// used to restore stacks without growing the current stack out of the way first.
+#if defined(ASM_HAS_CALLONSTACK)
+__externc __noreturn void _lh_callonstack(void* sp, void (*fun)(void*), void* arg);
+#endif
+
 // On most platforms C++ exception handling is done without exception frames on the stack.
 // An exception is 32-bit windows (x86). On such platform, when we resume we chain the
 // exception handling frames in the resumption to the outer-most exception frame below the resumption
@@ -164,6 +201,10 @@ typedef ptrdiff_t     count;   // signed natural machine word
 struct _handler;
 typedef struct _handler handler;
 
+// A bit set summary of effects; each effect maps to one bit so a set can be
+// used as a bloom filter: if the bit of an effect is not set, the effect is certainly not in the set.
+typedef uint64_t effectset;
+
 // A handler stack; Separate from the C-stack so it can be searched even if the C-stack contains fragments
 // Handler frames are variable size so we use a `byte*` for the frames.
 // Also, we use relative addressing (using `handler::prev`) such that an `hstack` can be reallocated
@@ -180,8 +221,33 @@ typedef struct _cstack {
   const void*        base;      // The `base` is the lowest/smallest adress of where the stack is captured
   ptrdiff_t          size;      // The byte size of the captured stack
   byte*              frames;    // The captured stack data (allocated in the heap)
+  struct _csegment*  shared;    // The part of the stack below `frames` that is shared with other captured stacks (or `NULL`)
 } cstack;
 
+// A reference counted immutable segment of a captured C stack. 
+// Captured stacks of multi-shot resumptions are split in segments that
+// can be shared by the stacks captured while running such resumption.
+typedef struct _csegment {
+  count              refcount;
+  struct _cstack     cstack;    // the segment itself; continues with `cstack.shared` below it 
+  struct _csegment*  owner;     // if not `NULL`, the frames are part of this (deduplicated) segment; otherwise they follow the segment in memory
+  struct _cchunk*    chunks;    // the chunks of this segment that are in the dedup table
+  count              marked;    // the last root enumeration that visited this segment
+} csegment;
+
+// A chunk of the frames of a captured C stack segment that can be shared by 
+// identical chunks of other captured stacks (see `lh_set_dedup`).
+// It is in the dedup table as long as its `owner` segment is alive.
+typedef struct _cchunk {
+  uintptr_t          hash;      // hash of the base and frames
+  struct _cchunk*    hnext;     // next chunk in the same bucket of the dedup table
+  struct _cchunk*    next;      // next chunk of the same owner
+  const void*        base;      
+  count              size;
+  struct _csegment*  owner;     // the segment that holds the frames
+  const byte*        frames;    // the frames inside the `owner` segment
+} cchunk;
+
 
 // A `fragment` is a captured C-stack and an `entry`.
 typedef struct _fragment {
@@ -189,6 +255,8 @@ typedef struct _fragment {
   struct _cstack     cstack;    // the captured c stack 
   count              refcount;  // fragments are allocated on the heap and reference counted.
   volatile lh_value  res;       // when jumped to, a result is passed through `res`
+  struct _fragment*  live_prev;  // enumeration: previous fragment in the list of live fragments of the thread
+  struct _fragment*  live_next;  // enumeration: next fragment in the list of live fragments of the thread
   #ifdef __cplusplus
   std::exception_ptr eptr;      // possible exception to rethrow when resuming the fragment
   #endif
@@ -221,6 +289,19 @@ typedef struct _resume {
   volatile lh_value  arg;         // the argument to `resume` is passed through `arg`.
   count              resumptions; // how often was this resumption resumed?
   struct exn_frame*  exn_bottom;  // 
+  bool               shallow;     // `true` if the captured hstack does not include the handler itself (`LH_OP_SHALLOW`)
+  lh_jmp_buf         hentry;      // shallow only: entry point of the handler (so it can be resumed under a new handler)
+  count              hgroup;      // shallow only: group of the handler
+  void*              hstackbase;  // shallow only: stack base of the handler
+  struct _resume*    cold_prev;   // compression: previous (older) resumption in the list of compression candidates
+  struct _resume*    cold_next;   // compression: next (younger) resumption in the list of compression candidates
+  count              captured_at; // compression: the capture count at the time this resumption was captured
+  byte*              compressed;  // compression: if not `NULL`, the compressed frames of `cstack` (and `cstack.frames==NULL`)
+  count              spilled;     // spilling: if not 0, the frames of `cstack` are in the spill store at offset `spilled-1` (and `cstack.frames==NULL`)
+  const struct _spillstore* spillstore;  // spilling: the spill store of the thread that spilled the frames
+  count              budgeted;    // budget: the captured bytes that are counted in the live captured bytes of the thread
+  struct _resume*    live_prev;   // enumeration: previous resumption in the list of live resumptions of the thread
+  struct _resume*    live_next;   // enumeration: next resumption in the list of live resumptions of the thread
 } resume;
 
 // An optimized resumption that can only used for tail-call resumptions (`lh_tail_resume`).
@@ -243,6 +324,7 @@ typedef struct _tailresume {
 struct _handler {
   lh_effect   effect;        // The effect that is handled (fragment, skip, and scoped handlers have their own effect)
   count       prev;          // the handler below on the stack is `prev` bytes before this one
+  effectset   summary;       // (over approximated) set of effects that a search starting at this handler can find
 };
 
 // Every handler type starts with a handler field (for safe upcasting)
@@ -258,6 +340,7 @@ typedef struct _effecthandler {
   struct _handler      handler;
   lh_jmp_buf           entry;       // used to jump back to a handler 
   count                id;          // uniquely identifies the handler (cannot always use pointer due to reallocation)
+  count                group;       // handlers installed together by `lh_handle_multi` share the `id` of the bottom one as group
   const lh_handlerdef* hdef;        // operation definitions
   volatile lh_value    arg;         // the yield argument is passed here
   const lh_operation*  arg_op;      // the yielded operation is passed here
@@ -265,6 +348,7 @@ typedef struct _effecthandler {
   void*                stackbase;   // pointer to the c-stack just below the handler
   lh_value             local;   
   struct exn_frame*    exn_frame;
+  struct _arena*       arena;       // captures are allocated in this `lh_handle_arena` arena (or NULL)
 } effecthandler;
 
 // A skip handler.
@@ -290,6 +374,14 @@ typedef struct _scopedhandler {
 // thread local `__hstack` is the 'shadow' handler stack
 __thread hstack __hstack = { NULL, 0, 0, NULL };
 
+// thread local `__hstack_epoch` is incremented whenever handlers can move in memory,
+// i.e. when a handler stack is reallocated or handlers are appended to it (on resume).
+// Cached pointers into `__hstack` (see `lh_localref`) are valid as long as it is unchanged.
+static __thread count __hstack_epoch = 1;
+
+// thread local peak size of `__hstack`
+static __thread count __hstack_peak = 0;
+
 
 /*-----------------------------------------------------------------
   Fatal errors
@@ -346,6 +438,153 @@ void lh_register_malloc(lh_mallocfun* _malloc, lh_callocfun* _calloc, lh_realloc
   custom_free = _free;
 }
 
+/*-----------------------------------------------------------------
+  Arena for handler stacks and captured stacks
+
+  When reserved with `lh_reserve_arena`, handler stacks and captured
+  C stacks are allocated from a per-thread region that is mapped at 
+  once, backed by transparent huge pages where possible, and 
+  pre-faulted; this avoids page faults when capturing. Blocks 
+  have a power-of-two size with a free list per size; each block 
+  starts with a small header that holds its size class. When the 
+  arena is exhausted we fall back to `lh_malloc`.
+
+  The same block allocator is used for the caller supplied memory 
+  of `lh_handle_arena`: those arenas form a per-thread list of 
+  scopes and captures of a handler installed in such scope are 
+  allocated from its arena. A scope that ends while some of its
+  blocks are still in use moves to a list of ended arenas until 
+  the program releases the resumptions that hold them.
+-----------------------------------------------------------------*/
+
+#define LH_ARENA_MINSHIFT  (6)    // smallest block is 64 bytes
+#define LH_ARENA_CLASSES   (40)
+#define LH_ARENA_HEADER    (16)   // keep the blocks 16-byte aligned
+#define LH_ARENA_ALIGN     (2*1024*1024)  // huge page size
+
+typedef struct _arena {
+  byte*  base;                      // the reserved region (or NULL)
+  count  size;                      // its size
+  count  top;                       // blocks are allocated below `top`
+  byte*  free[LH_ARENA_CLASSES];    // free list of blocks per size class (the next one is stored after the header)
+  count  live;                      // number of blocks in use
+  bool   ended;                     // is this a scope that ended with blocks in use?
+  struct _arena* next;              // the enclosing `lh_handle_arena` scope (or the next ended one)
+} arena;
+
+static __thread arena  __arena = { NULL, 0, 0, { NULL }, 0, false, NULL };
+static __thread arena* __arena_scopes = NULL;   // active `lh_handle_arena` scopes, innermost first
+static __thread arena* __arenas_ended = NULL;   // ended scopes with blocks that are still in use
+static __thread arena* __capture_arena = NULL;  // the arena used by the capture in progress
+
+// Is `p` allocated in arena `a`?
+static bool arena_contains(const arena* a, const void* p) {
+  return ((const byte*)p >= a->base && (const byte*)p < a->base + a->size);
+}
+
+// The arena of this thread that contains `p`, or NULL if `p` was allocated by `lh_malloc`.
+static arena* arena_owner(const void* p) {
+  if (p == NULL) return NULL;
+  if (arena_contains(&__arena, p)) return &__arena;
+  arena* a;
+  for (a = __arena_scopes; a != NULL; a = a->next) {
+    if (arena_contains(a, p)) return a;
+  }
+  for (a = __arenas_ended; a != NULL; a = a->next) {
+    if (arena_contains(a, p)) return a;
+  }
+  return NULL;
+}
+
+// Is `a` an active `lh_handle_arena` scope?
+static bool arena_scope_active(const arena* a) {
+  const arena* s;
+  for (s = __arena_scopes; s != NULL; s = s->next) {
+    if (s == a) return true;
+  }
+  return false;
+}
+
+// The size class of a block that can hold `size` bytes.
+static int arena_class(count size) {
+  int cls = 0;
+  while (((count)1 << (cls + LH_ARENA_MINSHIFT)) < size + LH_ARENA_HEADER) cls++;
+  return cls;
+}
+
+// Allocate `size` bytes from arena `a`; returns NULL if the arena is not reserved or exhausted.
+static void* arena_alloc(arena* a, count size) {
+  if (a->base == NULL) return NULL;
+  int cls = arena_class(size);
+  if (cls >= LH_ARENA_CLASSES) return NULL;
+  byte* block = a->free[cls];
+  if (block != NULL) {
+    memcpy(&a->free[cls], block + LH_ARENA_HEADER, sizeof(byte*));
+  }
+  else {
+    count blocksize = (count)1 << (cls + LH_ARENA_MINSHIFT);
+    if (a->top + blocksize > a->size) return NULL;
+    block = a->base + a->top;
+    a->top += blocksize;
+  }
+  *((count*)block) = cls;
+  a->live++;
+  return (block + LH_ARENA_HEADER);
+}
+
+// The usable size of an arena allocated block.
+static count arena_usable_size(const void* p) {
+  const byte* block = (const byte*)p - LH_ARENA_HEADER;
+  return (((count)1 << (*((const count*)block) + LH_ARENA_MINSHIFT)) - LH_ARENA_HEADER);
+}
+
+// Free a block allocated in arena `a`.
+static void arena_free(arena* a, void* p) {
+  assert(arena_contains(a, p) && a->live > 0);
+  byte* block = (byte*)p - LH_ARENA_HEADER;
+  int cls = (int)(*((count*)block));
+  memcpy(block + LH_ARENA_HEADER, &a->free[cls], sizeof(byte*));
+  a->free[cls] = block;
+  a->live--;
+  if (a->live == 0 && a->ended) {
+    // the last block of an ended scope is freed: forget the arena
+    arena** q = &__arenas_ended;
+    while (*q != a) q = &(*q)->next;
+    *q = a->next;
+  }
+}
+
+bool lh_reserve_arena(size_t size) {
+  #ifdef HAS_MMAP
+  if (__arena.base != NULL) {
+    if (__arena.live > 0) return false;  // still in use
+    munmap(__arena.base, (size_t)__arena.size);
+    memset(&__arena, 0, sizeof(arena));
+  }
+  if (size == 0) return true;
+  // round up to huge pages and map an aligned region
+  size = (size + LH_ARENA_ALIGN - 1) & ~((size_t)LH_ARENA_ALIGN - 1);
+  byte* map = (byte*)mmap(NULL, size + LH_ARENA_ALIGN, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == (byte*)MAP_FAILED) return false;
+  byte* base = (byte*)(((uintptr_t)map + LH_ARENA_ALIGN - 1) & ~((uintptr_t)LH_ARENA_ALIGN - 1));
+  if (base > map) munmap(map, (size_t)(base - map));
+  if (base + size < map + size + LH_ARENA_ALIGN) munmap(base + size, (size_t)((map + size + LH_ARENA_ALIGN) - (base + size)));
+  #ifdef MADV_HUGEPAGE
+  madvise(base, size, MADV_HUGEPAGE);
+  #endif
+  // pre-fault all pages
+  size_t i;
+  for (i = 0; i < size; i += 4096) {
+    ((volatile byte*)base)[i] = 0;
+  }
+  __arena.base = base;
+  __arena.size = (count)size;
+  return true;
+  #else
+  return (size == 0);
+  #endif
+}
+
 // Allocate memory and call `fatal` when out-of-memory
 #if defined(_MSC_VER) && defined(_DEBUG)
   // Enable debugging logs on msvc 
@@ -366,28 +605,145 @@ static void* checked_malloc(size_t size) {
 static void* checked_realloc(void* p, size_t size) {
   //assert((ptrdiff_t)(size) > 0); // check for overflow or negative sizes
   if ((ptrdiff_t)(size) <= 0) fatal(EINVAL, "invalid memory re-allocation size: %lu", (unsigned long)size);
+  arena* a = arena_owner(p);
+  if (a != NULL) {
+    // move out of the arena
+    count n = arena_usable_size(p);
+    void* q = checked_malloc(size);
+    memcpy(q, p, (size_t)(n < (count)size ? n : (count)size));
+    arena_free(a, p);
+    return q;
+  }
   void* q = lh_realloc(p, size);
   if (q == NULL) fatal(ENOMEM, "out of memory");
   return q;
 }
 static void checked_free(void* p) {
-  lh_free(p);
+  arena* a = arena_owner(p);
+  if (a != NULL) arena_free(a, p);
+            else lh_free(p);
+}
+#endif
+
+// Allocate a handler stack or captured stack buffer; uses the arena of the 
+// capture in progress, or the arena of this thread, if there is one.
+static void* buffer_malloc(size_t size) {
+  void* p = NULL;
+  #if !defined(_MSC_VER) || !defined(_DEBUG)  // the debug build frees with `free` directly
+  if (__capture_arena != NULL) p = arena_alloc(__capture_arena, (count)size);
+  if (p == NULL) p = arena_alloc(&__arena, (count)size);
+  #endif
+  return (p != NULL ? p : checked_malloc(size));
+}
+
+// Reallocate a buffer of `oldsize` bytes; uses an arena like `buffer_malloc`.
+static void* buffer_realloc(void* p, size_t oldsize, size_t size) {
+  if (__arena.base == NULL && __capture_arena == NULL && __arena_scopes == NULL) return checked_realloc(p, size);
+  if (p != NULL && arena_owner(p) != NULL && (count)size <= arena_usable_size(p)) return p;
+  void* q = buffer_malloc(size);
+  if (p != NULL) {
+    memcpy(q, p, (oldsize < size ? oldsize : size));
+    checked_free(p);
+  }
+  return q;
+}
+
+// Host allocation functions per object kind
+static lh_objallocfun* object_alloc[LH_OBJ_KINDS];
+static lh_objfreefun*  object_freefun[LH_OBJ_KINDS];
+static void*           object_arg[LH_OBJ_KINDS];
+
+// Each object is preceded by a header that records how it was allocated, so it is 
+// freed by the same functions even if other functions were registered since.
+typedef struct _objheader {
+  bool           host;      // allocated by a host allocation function?
+  lh_objfreefun* freefun;   // the host free function (can be `NULL`)
+  void*          arg;       // the argument of the host functions
+} objheader;
+
+#define OBJ_HEADER  ((sizeof(objheader) + 15) & ~((size_t)15))  // keep objects 16-byte aligned
+
+static objheader* object_header(void* p) {
+  return (objheader*)((byte*)p - OBJ_HEADER);
+}
+
+// Allocate an object of a given kind; uses the host allocation function if it is registered.
+static void* object_malloc(lh_objkind kind, size_t size) {
+  objheader* h;
+  if (object_alloc[kind] == NULL) {
+    h = (objheader*)buffer_malloc(OBJ_HEADER + size);
+    h->host = false;
+    h->freefun = NULL;
+    h->arg = NULL;
+  }
+  else {
+    h = (objheader*)object_alloc[kind](kind, OBJ_HEADER + size, object_arg[kind]);
+    if (h == NULL) fatal(ENOMEM, "out of memory");
+    h->host = true;
+    h->freefun = object_freefun[kind];
+    h->arg = object_arg[kind];
+  }
+  return ((byte*)h + OBJ_HEADER);
+}
+
+// Free an object of a given kind; host allocated objects are passed to the host.
+static void object_free(lh_objkind kind, void* p) {
+  objheader* h = object_header(p);
+  if (!h->host) checked_free(h);
+  else if (h->freefun != NULL) h->freefun(kind, h, h->arg);
+}
+
+// Reallocate an object of `oldsize` bytes (which can be `NULL`).
+static void* object_realloc(lh_objkind kind, void* p, size_t oldsize, size_t size) {
+  if (p == NULL) return object_malloc(kind, size);
+  objheader* h = object_header(p);
+  if (!h->host) {
+    h = (objheader*)buffer_realloc(h, OBJ_HEADER + oldsize, OBJ_HEADER + size);
+    return ((byte*)h + OBJ_HEADER);
+  }
+  void* q = object_malloc(kind, size);
+  memcpy(q, p, (oldsize < size ? oldsize : size));
+  object_free(kind, p);
+  return q;
 }
+
+// Set up different allocation functions for this thread only
+static __thread lh_mallocfun* thread_malloc = NULL;
+static __thread lh_callocfun* thread_calloc = NULL;
+static __thread lh_reallocfun* thread_realloc = NULL;
+static __thread lh_freefun* thread_free = NULL;
+
+#ifndef NDEBUG
+// Forward
+static bool thread_has_buffers(void);
 #endif
 
+void lh_register_thread_malloc(lh_mallocfun* _malloc, lh_callocfun* _calloc, lh_reallocfun* _realloc, lh_freefun* _free) {
+  // buffers are freed with the functions registered at that time
+  assert(!thread_has_buffers());
+  thread_malloc = _malloc;
+  thread_calloc = _calloc;
+  thread_realloc = _realloc;
+  thread_free = _free;
+}
+
 void* lh_malloc(size_t size) {
+  if (thread_malloc != NULL) return thread_malloc(size);
   return (custom_malloc == NULL ? malloc(size) : custom_malloc(size));  
 }
 void* lh_calloc(size_t n, size_t size) {
+  if (thread_calloc != NULL) return thread_calloc(n, size);
   return (custom_calloc == NULL ? calloc(n,size) : custom_calloc(n,size));
 }
 void* lh_realloc(void* p, size_t size) {
+  if (thread_realloc != NULL) return thread_realloc(p, size);
   return (custom_realloc == NULL ? realloc(p, size) : custom_realloc(p, size));  
 }
 void lh_free(void* p) {
   assert(p != NULL);
   if (p == NULL) return;
-  if (custom_free == NULL) free(p);
+  if (thread_free != NULL) thread_free(p);
+  else if (custom_free == NULL) free(p);
   else custom_free(p);
 }
 static char* _lh_strndup(const char* s, size_t max) {
@@ -431,11 +787,20 @@ static __noinline void* _stack_address(void* p) {
   return p;
 }
 
+#if defined(HAS_ASMSETJMP)
+// With our own assembly we get the exact stack pointer of the caller,
+// so a capture copies only the live part of the stack.
+#define get_stack_top()  _lh_get_sp()
+#define LH_STACK_SLACK   (0)
+#else
 // .. And pass the stack top location by address to it:
 static __noinline void* get_stack_top() {
   void* top = NULL;
   return _stack_address(&top);
 }
+// the approximate top is below the caller so we need some slack for its frame
+#define LH_STACK_SLACK   (0x200)
+#endif
 
 // true if the stack grows up
 static bool stackup = false;
@@ -520,6 +885,19 @@ static struct {
   long rcont_captured_fragment;
   long rcont_captured_empty;
   count rcont_captured_size;
+  count rcont_captured_cstack;
+  count rcont_captured_copied;
+  count rcont_captured_shared;
+  count rcont_captured_deduped;
+  count rcont_restore_reserved;
+  long  rcont_over_budget;
+  long  rcont_compressed;
+  count rcont_compressed_size;
+  count rcont_compressed_saved;
+  long  rcont_decompressed;
+  long  rcont_spilled;
+  count rcont_spilled_size;
+  long  rcont_unspilled;
 
   long rcont_resumed_scoped;
   long rcont_resumed_resume;
@@ -531,8 +909,11 @@ static struct {
 
   long operations;
   count hstack_max;
+  long  hstack_shrunk;
+  long  lookup_frames;
+  long  lookup_cut;
 } stats = {
-    0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
     0, 0, 0, 
     0, 0,
     0, 0, 
@@ -572,11 +953,33 @@ void lh_print_stats(FILE* h) {
     fprintf(h, "    empty     :%6li\n", stats.rcont_captured_empty);
     fprintf(h, "    total size:%6li kb\n", (long)((stats.rcont_captured_size + 1023) / 1024));
     fprintf(h, "    avg size  :%6li bytes\n", (long)((stats.rcont_captured_size / (captured > 0 ? captured : 1))));
+    fprintf(h, "    avg copied:%6li bytes\n", (long)((stats.rcont_captured_copied / (captured > 0 ? captured : 1))));
+    fprintf(h, "    avg shared:%6li bytes\n", (long)((stats.rcont_captured_shared / (captured > 0 ? captured : 1))));
+    fprintf(h, "    avg dedup :%6li bytes\n", (long)((stats.rcont_captured_deduped / (captured > 0 ? captured : 1))));
+    fprintf(h, "    avg alloca:%6li bytes (to restore)\n", (long)((stats.rcont_restore_reserved / (resumed > 0 ? resumed : 1))));
+    if (stats.rcont_compressed > 0) {
+      fprintf(h, "  compressed  :%li\n", stats.rcont_compressed);
+      fprintf(h, "    total size:%6li kb\n", (long)((stats.rcont_compressed_size + 1023) / 1024));
+      fprintf(h, "    saved     :%6li kb\n", (long)((stats.rcont_compressed_saved + 1023) / 1024));
+      fprintf(h, "    resumed   :%6li\n", stats.rcont_decompressed);
+    }
+    if (stats.rcont_over_budget > 0) {
+      fprintf(h, "  over budget :%li\n", stats.rcont_over_budget);
+      fprintf(h, "    live peak :%6li kb\n", (long)((__captured_live_peak + 1023) / 1024));
+    }
+    if (stats.rcont_spilled > 0) {
+      fprintf(h, "  spilled     :%li\n", stats.rcont_spilled);
+      fprintf(h, "    total size:%6li kb\n", (long)((stats.rcont_spilled_size + 1023) / 1024));
+      fprintf(h, "    resumed   :%6li\n", stats.rcont_unspilled);
+    }
     if (captured != stats.rcont_released) {
       fprintf(h, "  released    :%li\n", stats.rcont_released);
       fprintf(h, "    total size:%6li kb\n", (long)((stats.rcont_released_size + 1023) / 1024));
     }
     fprintf(h, "  hstack max  :%li kb\n", (long)(stats.hstack_max + 1023) /1024);
+    if (stats.hstack_shrunk > 0) {
+      fprintf(h, "  hstack shrunk:%li\n", stats.hstack_shrunk);
+    }
   }
   # ifdef _DEBUG_STATS
   fputs("operations:\n", h);
@@ -603,6 +1006,36 @@ void lh_check_memory(FILE* h) {
 }
 #endif
 
+// The live captured bytes of the resumptions of this thread (and the peak)
+static __thread count __captured_live = 0;
+static __thread count __captured_live_peak = 0;
+
+// Get statistics about captured continuations.
+void lh_get_stats(lh_stats* st) {
+  if (st == NULL) return;
+  st->captured = stats.rcont_captured_scoped + stats.rcont_captured_resume + stats.rcont_captured_fragment;
+  st->resumed  = stats.rcont_resumed_scoped + stats.rcont_resumed_resume + stats.rcont_resumed_fragment + stats.rcont_resumed_tail;
+  st->released = stats.rcont_released;
+  st->captured_size = stats.rcont_captured_size;
+  st->captured_cstack = stats.rcont_captured_cstack;
+  st->captured_copied = stats.rcont_captured_copied;
+  st->captured_shared = stats.rcont_captured_shared;
+  st->captured_deduped = stats.rcont_captured_deduped;
+  st->restore_reserved = stats.rcont_restore_reserved;
+  st->captured_live = __captured_live;
+  st->captured_live_peak = __captured_live_peak;
+  st->over_budget = stats.rcont_over_budget;
+  st->compressed = stats.rcont_compressed;
+  st->compressed_saved = stats.rcont_compressed_saved;
+  st->spilled = stats.rcont_spilled;
+  st->spilled_size = stats.rcont_spilled_size;
+  st->hstack_size = __hstack.size;
+  st->hstack_peak = __hstack_peak;
+  st->hstack_shrunk = stats.hstack_shrunk;
+  st->lookup_frames = stats.lookup_frames;
+  st->lookup_cut = stats.lookup_cut;
+}
+
 /*-----------------------------------------------------------------
   Cstack
 -----------------------------------------------------------------*/
@@ -611,17 +1044,109 @@ static void cstack_init(ref cstack* cs) {
   cs->base = NULL;
   cs->size = 0;
   cs->frames = NULL;
+  cs->shared = NULL;
 }
 
+static void csegment_release(csegment* seg);
+
 static void cstack_free(ref cstack* cs) {
   assert(cs != NULL);
   if (cs->frames != NULL) {
-    checked_free(cs->frames);
+    object_free(LH_OBJ_CSTACK, cs->frames);
+    cs->frames = NULL;
+    cs->size = 0;
+  }
+  if (cs->shared != NULL) {
+    csegment_release(cs->shared);
+    cs->shared = NULL;
+  }
+}
+
+// Forward
+static void dedup_remove(cchunk* chunks);
+static csegment* csegment_acquire(csegment* seg);
+
+// Allocate a new stack segment of `size` bytes at `base` on top of `below`; the frames 
+// are either the `frames` of a deduplicated `owner` segment or allocated inline.
+static csegment* csegment_alloc(const void* base, count size, csegment* below, csegment* owner, const byte* frames) {
+  csegment* seg = (csegment*)object_malloc(LH_OBJ_CSTACK, sizeof(csegment) + (owner == NULL ? size : 0));
+  seg->refcount = 1;
+  seg->cstack.base = base;
+  seg->cstack.size = size;
+  seg->cstack.frames = (owner == NULL ? (byte*)(seg + 1) : (byte*)frames);
+  seg->cstack.shared = below;
+  seg->owner = (owner == NULL ? NULL : csegment_acquire(owner));
+  seg->chunks = NULL;
+  seg->marked = 0;
+  return seg;
+}
+
+// Release a stack segment (and the segments below it)
+static void csegment_release(csegment* seg) {
+  while (seg != NULL) {
+    assert(seg->refcount > 0);
+    if (seg->refcount > 1) {
+      seg->refcount--;
+      return;
+    }
+    // an owner never shares frames itself so this recursion is only one level deep per owner
+    if (seg->owner != NULL) csegment_release(seg->owner);
+    if (seg->chunks != NULL) dedup_remove(seg->chunks);
+    if (seg->owner == NULL && seg->cstack.frames != (byte*)(seg + 1)) object_free(LH_OBJ_CSTACK, seg->cstack.frames);  // adopted frames
+    csegment* below = seg->cstack.shared;
+    object_free(LH_OBJ_CSTACK, seg);
+    seg = below;
+  }
+}
+
+static csegment* csegment_acquire(csegment* seg) {
+  assert(seg != NULL && seg->refcount > 0);
+  seg->refcount++;
+  return seg;
+}
+
+// Turn the frames of a captured c-stack into a segment without copying them; 
+// the segment is only used as the owner of segments that share its frames.
+static csegment* csegment_adopt(ref cstack* cs) {
+  assert(cs->frames != NULL && cs->shared == NULL);
+  csegment* seg = (csegment*)object_malloc(LH_OBJ_CSTACK, sizeof(csegment));
+  seg->refcount = 1;
+  seg->cstack = *cs;
+  seg->owner = NULL;
+  seg->chunks = NULL;
+  seg->marked = 0;
+  cstack_init(cs);
+  return seg;
+}
+
+
+// A spare captured c-stack whose unchanged bottom can be shared by a next capture of the 
+// same stack region. This is usually the c-stack of a resumption that was resumed for the
+// last time; for example, a generator yields from the same stack region each time and 
+// only the top part of the stack changes between yields.
+static __thread cstack __cstack_spare = { NULL, 0, NULL, NULL };
+
+// Keep the frames of a c-stack that is no longer needed as the spare c-stack.
+static void cstack_recycle(ref cstack* cs) {
+  assert(cs != NULL);
+  if (cs->frames != NULL && cs->shared == NULL) {
+    cstack_free(&__cstack_spare);
+    __cstack_spare = *cs;
     cs->frames = NULL;
     cs->size = 0;
   }
+  else {
+    cstack_free(cs);
+  }
 }
 
+// Register host allocation functions for a kind of object
+void lh_register_object_alloc(lh_objkind kind, lh_objallocfun* _alloc, lh_objfreefun* _free, void* arg) {
+  if ((int)kind < 0 || (int)kind >= LH_OBJ_KINDS) fatal(EINVAL, "invalid object kind: %i", (int)kind);
+  object_alloc[kind] = _alloc;
+  object_freefun[kind] = (_alloc == NULL ? NULL : _free);
+  object_arg[kind] = arg;
+}
 
 // Return the lowest address to a c-stack regardless if the stack grows up or down
 static const byte* cstack_base(const cstack* cs) {
@@ -633,11 +1158,17 @@ static const void* cstack_top(const cstack* cs) {
   return stack_top(cs->base, cs->size);
 }
 
-// Return the bottom of the c-stack
+// Return the bottom of the c-stack (including any shared segments)
 static const void* cstack_bottom(const cstack* cs) {
+  while (cs->shared != NULL) cs = &cs->shared->cstack;
   return stack_bottom(cs->base, cs->size);
 }
 
+// Is the c-stack empty?
+static bool cstack_empty(const cstack* cs) {
+  return (cs->frames == NULL && cs->shared == NULL);
+}
+
 
 // Pointer difference in bytes
 static ptrdiff_t ptrdiff(const void* p, const void* q) {
@@ -650,6 +1181,23 @@ static ptrdiff_t ptrdiff(const void* p, const void* q) {
   Fragments
 -----------------------------------------------------------------*/
 
+// The live fragments of this thread, most recently captured first
+static __thread fragment* __fragments_live = NULL;
+
+static void fragment_link_live(fragment* f) {
+  f->live_prev = NULL;
+  f->live_next = __fragments_live;
+  if (__fragments_live != NULL) __fragments_live->live_prev = f;
+  __fragments_live = f;
+}
+
+static void fragment_unlink_live(fragment* f) {
+  if (f->live_prev != NULL) f->live_prev->live_next = f->live_next;
+                       else __fragments_live = f->live_next;
+  if (f->live_next != NULL) f->live_next->live_prev = f->live_prev;
+  f->live_prev = f->live_next = NULL;
+}
+
 // release a continuation; returns `true` if it was released
 static __noinline void fragment_free_(fragment* f) {
   #ifdef _STATS
@@ -660,7 +1208,8 @@ static __noinline void fragment_free_(fragment* f) {
   f->eptr = NULL;
   #endif
   cstack_free(&f->cstack);
-  checked_free(f);
+  fragment_unlink_live(f);
+  object_free(LH_OBJ_FRAGMENT, f);
 }
 
 static void _fragment_release(fragment* f) {
@@ -701,6 +1250,25 @@ static fragment* fragment_acquire(fragment* f) {
 -----------------------------------------------------------------*/
 // Forward
 static void hstack_free(ref hstack* hs, bool do_release);
+static void resume_cold_free(resume* r);
+static void budget_release(resume* r);
+
+// The live resumptions of this thread, most recently captured first
+static __thread resume* __resumes_live = NULL;
+
+static void resume_link_live(resume* r) {
+  r->live_prev = NULL;
+  r->live_next = __resumes_live;
+  if (__resumes_live != NULL) __resumes_live->live_prev = r;
+  __resumes_live = r;
+}
+
+static void resume_unlink_live(resume* r) {
+  if (r->live_prev != NULL) r->live_prev->live_next = r->live_next;
+                       else __resumes_live = r->live_next;
+  if (r->live_next != NULL) r->live_next->live_prev = r->live_prev;
+  r->live_prev = r->live_next = NULL;
+}
 
 // release a resumptions; returns `true` if it was released
 static __noinline void _resume_free(resume* r) {
@@ -709,9 +1277,12 @@ static __noinline void _resume_free(resume* r) {
   stats.rcont_released++;
   stats.rcont_released_size += (long)r->cstack.size + (long)r->hstack.size;
   #endif
-  cstack_free(&r->cstack);
+  resume_cold_free(r);
+  budget_release(r);
+  cstack_recycle(&r->cstack);
   hstack_free(&r->hstack,true);
-  checked_free(r);
+  resume_unlink_live(r);
+  object_free(LH_OBJ_RESUME, r);
 }
 
 static void _resume_release(resume* r) {
@@ -766,17 +1337,16 @@ static bool is_scopedhandler(const handler* h) {
 }
 
 
-#ifndef NDEBUG
 static bool is_effecthandler(const handler* h) {
   return (!is_skiphandler(h) && !is_fragmenthandler(h) && !is_scopedhandler(h));
 }
+
 static count handler_size(const lh_effect effect) {
   if (effect == LH_EFFECT(__skip)) return sizeof(skiphandler);
   else if (effect == LH_EFFECT(__fragment)) return sizeof(fragmenthandler);
   else if (effect == LH_EFFECT(__scoped)) return sizeof(scopedhandler);
   else return sizeof(effecthandler);
 }
-#endif
 
 // Return the handler below on the stack
 static handler* _handler_prev(const handler* h) {
@@ -790,6 +1360,32 @@ static handler* _handler_prev_skip(const skiphandler* sh) {
   return (handler*)((byte*)sh - sh->toskip);
 }
 
+// The bit of an effect in an `effectset`. 
+// Effects are static arrays so we ignore the lower (alignment) bits of the address.
+static effectset effect_bit(lh_effect effect) {
+  uintptr_t x = (uintptr_t)effect >> 3;
+  x ^= (x >> 6) ^ (x >> 12);
+  return ((effectset)1 << (x & 63));
+}
+
+// Set the summary of a handler: the effects that a search starting at `h` may find.
+// That is its own effect plus the summary of the frame below it. A skip frame 
+// takes the summary from below the frames it skips, while fragment and scoped
+// frames just pass on the summary below them. Together this gives a summary per 
+// segment between fragment and skip frames so a search can stop as soon 
+// as the rest of the stack cannot contain the effect.
+static void handler_summarize(handler* h) {
+  const handler* below = h;
+  effectset own = 0;
+  if (is_skiphandler(h)) {
+    below = _handler_prev_skip((skiphandler*)h);
+  }
+  else if (is_effecthandler(h)) {
+    own = effect_bit(h->effect);
+  }
+  h->summary = own | (below->prev == 0 ? 0 : _handler_prev(below)->summary);
+}
+
 static void handler_release(handler* h) {
   if (is_fragmenthandler(h)) {
     fragment_release_at(&((fragmenthandler*)h)->fragment);
@@ -922,14 +1518,40 @@ static count hstack_topsize(const hstack* hs) {
 static void hstack_realloc_(ref hstack* hs, count needed) {
   count newsize = hstack_goodsize(needed);
   count topsize = hstack_topsize(hs);
-  hs->hframes = (byte*)checked_realloc(hs->hframes, newsize);
+  hs->hframes = (byte*)object_realloc(LH_OBJ_HSTACK, hs->hframes, (size_t)hs->size, newsize);
   hs->size = newsize;
+  __hstack_epoch++;
   hs->top = hstack_at(hs, topsize);
+  if (hs == &__hstack && newsize > __hstack_peak) __hstack_peak = newsize;
   #ifdef _STATS
   if (newsize > stats.hstack_max) stats.hstack_max = newsize;
   #endif
 }
 
+// The handler stack is shrunk once it uses less than `1/LH_HSTACK_SHRINK` of its size,
+// to about twice its use; this leaves enough room so we do not oscillate between growing and shrinking.
+#define LH_HSTACK_SHRINK  (8)
+
+// Shrink the handler stack after a spike in its use.
+static void hstack_shrink(ref hstack* hs) {
+  if (hs->size > (count)HMINSIZE && hs->count > 0 && hs->count <= hs->size / LH_HSTACK_SHRINK) {
+    hstack_realloc_(hs, 2*hs->count);
+    #ifdef _STATS
+    stats.hstack_shrunk++;
+    #endif
+  }
+}
+
+void lh_hstack_trim(void) {
+  hstack* hs = &__hstack;
+  if (hs->size > 0 && hstack_goodsize(hs->count) < hs->size) {
+    hstack_realloc_(hs, hs->count);
+    #ifdef _STATS
+    stats.hstack_shrunk++;
+    #endif
+  }
+}
+
 // Return the previous handler, or NULL if at the bottom frame
 static handler* hstack_prev(hstack* hs, handler* h) {
   assert(valid_handler(hs, h));
@@ -958,7 +1580,7 @@ static void hstack_free(ref hstack* hs, bool do_release) {
       } 
       while (h != NULL);
     }
-    checked_free(hs->hframes);
+    object_free(LH_OBJ_HSTACK, hs->hframes);
     hstack_init(hs);
   }
 }
@@ -1011,6 +1633,7 @@ static handler* _hstack_push(ref hstack* hs, lh_effect effect, count size) {
   assert((hs->count > 0 && h->prev > 0) || (hs->count == 0 && h->prev == 0));
   hs->top = h;
   hs->count += size;
+  if (effect != LH_EFFECT(__skip)) handler_summarize(h); // skip frames are summarized once `toskip` is set
   return h;
 }
 
@@ -1020,10 +1643,12 @@ static effecthandler* hstack_push_effect(ref hstack* hs, const lh_handlerdef* hd
   static count id = 1000;
   effecthandler* h = (effecthandler*)_hstack_push(hs, hdef->effect, sizeof(effecthandler));
   h->id = id++;
+  h->group = h->id;
   h->hdef = hdef;
   h->stackbase = stackbase;
   h->local = local;
   h->exn_frame = NULL;
+  h->arena = __arena_scopes;
   h->arg = lh_value_null;
   h->arg_op = NULL;
   h->arg_resume = NULL;
@@ -1034,6 +1659,7 @@ static effecthandler* hstack_push_effect(ref hstack* hs, const lh_handlerdef* hd
 static skiphandler* hstack_push_skip(ref hstack* hs, count toskip) {
   skiphandler* h = (skiphandler*)_hstack_push(hs, LH_EFFECT(__skip), sizeof(skiphandler));
   h->toskip = toskip;
+  handler_summarize(to_handler(h));
   return h;
 }
 
@@ -1060,8 +1686,16 @@ static handler* hstack_append_movefrom(ref hstack* hs, ref hstack* topush, const
   handler* bot = hstack_ensure_space(hs, needed);
   memcpy(bot, from, needed);
   bot->prev = hstack_topsize(hs);
+  __hstack_epoch++;
   hs->count += needed;
   hs->top = hstack_at(hs,hstack_topsize(topush));
+  // the summaries of the moved handlers need to include the handlers below them now
+  handler* h = bot;
+  while (true) {
+    handler_summarize(h);
+    if (h == hs->top) break;
+    h = (handler*)((byte*)h + handler_size(h->effect));
+  }
   return bot;
 }
 
@@ -1080,13 +1714,23 @@ static handler* hstack_append_copyfrom(ref hstack* hs, ref hstack* tocopy, handl
   return bot;
 }
 
-// Find an operation that handles `optag` in the handler stack.
-static effecthandler* hstack_find(ref hstack* hs, lh_optag optag, out const lh_operation** op, out count* skipped) {
-  if (!hstack_empty(hs)) {
-    handler* h = hstack_top(hs);
+// Find an operation that handles `optag` in the handler stack starting at handler `h` (which can be `NULL`); 
+// returns `NULL` if not found.
+static effecthandler* hstack_try_find_from(ref hstack* hs, handler* h, lh_optag optag, out const lh_operation** op, out count* skipped) {
+  if (h != NULL) {
+    const effectset bit = effect_bit(optag->effect);
     do {
       assert(valid_handler(hs, h));
-      if (h->effect == optag->effect) {
+      #ifdef _STATS
+      stats.lookup_frames++;
+      #endif
+      if ((h->summary & bit) == 0) {
+        #ifdef _STATS
+        stats.lookup_cut++;
+        #endif
+        break; // no handler below can handle this effect
+      }
+      else if (h->effect == optag->effect) {
         effecthandler* eh = (effecthandler*)h;
         assert(eh->hdef != NULL);
         const lh_operation* oper = &eh->hdef->operations[optag->opidx];
@@ -1104,12 +1748,141 @@ static effecthandler* hstack_find(ref hstack* hs, lh_optag optag, out const lh_o
       h = hstack_prev(hs, h);
     } while (h != NULL);
   }
-  fatal(ENOSYS, "no handler for operation found: '%s'", lh_optag_name(optag));
   *skipped = 0;
   *op = NULL;
   return NULL;
 }
 
+// Find an operation that handles `optag` in the handler stack; returns `NULL` if not found.
+static effecthandler* hstack_try_find(ref hstack* hs, lh_optag optag, out const lh_operation** op, out count* skipped) {
+  return hstack_try_find_from(hs, (hstack_empty(hs) ? NULL : hstack_top(hs)), optag, op, skipped);
+}
+
+// Find the innermost effect handler for `effect` that is not skipped; returns `NULL` if not found.
+static effecthandler* hstack_find_handler(ref hstack* hs, lh_effect effect, count id) {
+  if (hstack_empty(hs)) return NULL;
+  const effectset bit = effect_bit(effect);
+  handler* h = hstack_top(hs);
+  do {
+    assert(valid_handler(hs, h));
+    #ifdef _STATS
+    stats.lookup_frames++;
+    #endif
+    if ((h->summary & bit) == 0) {
+      #ifdef _STATS
+      stats.lookup_cut++;
+      #endif
+      break; // no handler below handles this effect
+    }
+    else if (h->effect == effect && (id == 0 || ((effecthandler*)h)->id == id)) {
+      return (effecthandler*)h;
+    }
+    else if (is_skiphandler(h)) {
+      h = hstack_prev_skip(hs, (skiphandler*)h);
+    }
+    h = hstack_prev(hs, h);
+  } while (h != NULL);
+  return NULL;
+}
+
+
+/*-----------------------------------------------------------------
+  Default handlers
+  A process wide registry of handlers that are only consulted when
+  no handler is found on the handler stack. As if they are installed
+  at the bottom of every handler stack, but without pushing frames.
+-----------------------------------------------------------------*/
+
+// A registered default handler.
+typedef struct _defaulthandler {
+  const lh_handlerdef* hdef;
+  lh_value             local;
+} defaulthandler;
+
+static defaulthandler* defaults = NULL;
+static count           defaults_count = 0;
+static count           defaults_size = 0;
+static effectset       defaults_summary = 0;  // union of the `effect_bit`s of all default handlers
+
+static defaulthandler* defaults_find_effect(lh_effect effect) {
+  count i;
+  for (i = 0; i < defaults_count; i++) {
+    if (defaults[i].hdef->effect == effect) return &defaults[i];
+  }
+  return NULL;
+}
+
+// Find a default handler for `optag`; returns `NULL` if not found.
+static defaulthandler* defaults_find(lh_optag optag, out const lh_operation** op) {
+  if ((defaults_summary & effect_bit(optag->effect)) != 0) {
+    defaulthandler* d = defaults_find_effect(optag->effect);
+    if (d != NULL && d->hdef->operations != NULL) {
+      const lh_operation* oper = &d->hdef->operations[optag->opidx];
+      assert(oper->optag == optag);
+      if (oper->opfun != NULL) {
+        *op = oper;
+        return d;
+      }
+    }
+  }
+  *op = NULL;
+  return NULL;
+}
+
+static void defaults_summarize() {
+  defaults_summary = 0;
+  count i;
+  for (i = 0; i < defaults_count; i++) {
+    defaults_summary |= effect_bit(defaults[i].hdef->effect);
+  }
+}
+
+// Register a default handler; any previous default for the same effect is released.
+void lh_register_default_handler(const lh_handlerdef* hdef, lh_value local) {
+  if (hdef == NULL) {
+    fatal(EINVAL, "default handler definition cannot be NULL");
+    return;
+  }
+  if (hdef->operations != NULL) {
+    const lh_operation* op;
+    for (op = hdef->operations; op->opkind != LH_OP_NULL; op++) {
+      if (op->opfun != NULL && op->opkind != LH_OP_TAIL && op->opkind != LH_OP_TAIL_NOOP) {
+        fatal(EINVAL, "default handler operations must be tail resumptive: '%s'", lh_optag_name(op->optag));
+        return;
+      }
+    }
+  }
+  lh_unregister_default_handler(hdef->effect);
+  if (defaults_count >= defaults_size) {
+    count newsize = (defaults_size == 0 ? 4 : 2 * defaults_size);
+    defaults = (defaulthandler*)checked_realloc(defaults, newsize * sizeof(defaulthandler));
+    defaults_size = newsize;
+  }
+  defaults[defaults_count].hdef = hdef;
+  defaults[defaults_count].local = local;
+  defaults_count++;
+  defaults_summary |= effect_bit(hdef->effect);
+}
+
+// Unregister the default handler for `effect` and release its local state.
+bool lh_unregister_default_handler(lh_effect effect) {
+  defaulthandler* d = defaults_find_effect(effect);
+  if (d == NULL) return false;
+  defaulthandler old = *d;
+  defaults_count--;
+  *d = defaults[defaults_count];  // keep the array compact; the order is irrelevant
+  if (defaults_count == 0) {
+    checked_free(defaults);
+    defaults = NULL;
+    defaults_size = 0;
+  }
+  defaults_summarize();
+  if (old.hdef->local_release != NULL) {
+    old.hdef->local_release(old.local);
+  }
+  return true;
+}
+
 
 
 
@@ -1132,6 +1905,7 @@ const byte* _max(const byte* p, const byte* q) { return (p >= q ? p : q); }
 
 // Extend cstack `cs` in-place to encompass both the `ds` stack and itself.
 static void cstack_extendfrom(ref cstack* cs, ref cstack* ds, bool will_free_ds) {
+  assert(cs->shared == NULL && ds->shared == NULL); // fragments never share segments
   const byte* csb = cstack_base(cs);
   const byte* dsb = cstack_base(ds);
   if (cs->frames == NULL) {
@@ -1146,7 +1920,7 @@ static void cstack_extendfrom(ref cstack* cs, ref cstack* ds, bool will_free_ds)
       }
       else {
         // otherwise copy the c-stack from ds
-        cs->frames = (byte*)checked_malloc(ds->size);
+        cs->frames = (byte*)object_malloc(LH_OBJ_CSTACK, ds->size);
         memcpy(cs->frames, ds->frames, ds->size);
         cs->base = ds->base;
         cs->size = ds->size;
@@ -1160,7 +1934,7 @@ static void cstack_extendfrom(ref cstack* cs, ref cstack* ds, bool will_free_ds)
     // check if we need to reallocate; no need if `ds` fits right in.
     if (csb != newbase || cs->size != newsize) {
       // reallocate..
-      byte* newframes = (byte*)checked_malloc(newsize);
+      byte* newframes = (byte*)object_malloc(LH_OBJ_CSTACK, newsize);
       // if non-overlapping, copy the current stack first into the gap
       // (there is never a gap at the ends as `cs` or `ds` either start or end the `newframes`).
       if ((dsb > csb + cs->size) || (dsb + ds->size < csb)) {
@@ -1172,7 +1946,7 @@ static void cstack_extendfrom(ref cstack* cs, ref cstack* ds, bool will_free_ds)
       assert(csb + cs->size <= newbase + newsize);
       memcpy(newframes + (csb - newbase), cs->frames, cs->size);
       // and update cs
-      checked_free(cs->frames);
+      object_free(LH_OBJ_CSTACK, cs->frames);
       cs->frames = newframes;
       cs->size = newsize;
       cs->base = newbase;
@@ -1227,100 +2001,1130 @@ static void hstack_pop_upto(ref hstack* hs, ref handler* h, bool do_release, out
 
 
 /*-----------------------------------------------------------------
-  Initialize globals
+  Sharing captured stacks
+  When a multi-shot resumption is resumed, its captured stack is split
+  into immutable segments; further captures while running the resumption
+  share the bottom segments that are still unchanged (which we check by 
+  comparing as frames can always be written through pointers). For example,
+  in a backtracking search the captured stacks now only take space for the
+  parts that diverge.
 -----------------------------------------------------------------*/
 
-static bool initialized = false;
-static struct exn_frame* exn_bottom = NULL;
+// Size of the segments of a shared captured stack; segments are aligned at this size
+// so the segments of different captures of the same stack region line up.
+#define LH_CSEGMENT_SIZE  (4096)
 
-static __noinline bool _lh_init(hstack* hs) {
-  if (!initialized) {
-    initialized = true;
-    infer_stackdir();
-    exn_bottom = _lh_get_exn_top();
-    if (exn_bottom != NULL) {
-      // find the outermost exception handler (on win32, the chain is stopped with a -1)      
-      while (exn_bottom->previous != NULL && exn_bottom->previous != (struct exn_frame*)(-1)) {
-        exn_bottom = exn_bottom->previous;
-      }
-    }
+// The shared stack segments of the most recently resumed resumption.
+static __thread csegment* __cstack_parent = NULL;
+
+// Return the top of the aligned chunk of at most `size` bytes starting at `p` towards the 
+// top of the stack, and not beyond `lo` or `hi`.
+static const byte* stack_chunk_top(const byte* p, count size, const byte* lo, const byte* hi) {
+  const byte* q;
+  if (stackup) {
+    q = (const byte*)((((uintptr_t)p / size) + 1) * size);
+    if (q > hi) q = hi;
   }
-  stackbottom = get_stack_top(); // in debug mode we use this to check if operation arguments are not passed on the stack
-  assert(__hstack.size==0 && hs == &__hstack);
-  hstack_init(hs);
-  return true;
+  else {
+    q = (const byte*)((((uintptr_t)p - 1) / size) * size);
+    if (q < lo) q = lo;
+  }
+  return q;
 }
 
-static bool lh_init(hstack* hs) {
-  if (hs->size!=0) return false;
-              else return _lh_init(hs);
+// Split the frames of a captured stack in segments of at most `segsize` bytes (aligned at `segsize`).
+static void cstack_split(ref cstack* cs, count segsize) {
+  if (cs->frames == NULL) return;
+  const byte* lo = cstack_base(cs);
+  const byte* hi = lo + cs->size;
+  csegment* seg = cs->shared;                 // the segment below the current one
+  const byte* p = (stackup ? lo : hi);        // bottom of the next segment
+  while (p != (stackup ? hi : lo)) {
+    const byte* q = stack_chunk_top(p, segsize, lo, hi);  // top of the next segment
+    const byte* base = _min(p, q);
+    count size = (p < q ? q - p : p - q);
+    seg = csegment_alloc(base, size, seg, NULL, NULL);
+    memcpy(seg->cstack.frames, cs->frames + (base - lo), size);
+    p = q;
+  }
+  object_free(LH_OBJ_CSTACK, cs->frames);
+  cs->frames = NULL;
+  cs->size = 0;
+  cs->base = (stackup ? hi : lo);             // the top of the shared segments
+  cs->shared = seg;
 }
 
-static __noinline void lh_done(hstack* hs) {
-  assert(hs == &__hstack && hs->size>0 && hs->count==0 && (byte*)hs->top==&hs->hframes[0]);
-  hstack_free(hs,true);
+// Split the frames of a captured stack in segments that can be shared.
+static void cstack_freeze(ref cstack* cs) {
+  cstack_split(cs, LH_CSEGMENT_SIZE);
 }
 
-#ifdef __cplusplus
-class _raii_hstack_init {
-private:
-  bool init;
-  hstack* hs;
-public:
-  _raii_hstack_init(hstack* _hs) {
-    hs = _hs;
-    init = lh_init(hs);
-  }
-  ~_raii_hstack_init() {
-    if (init) lh_done(hs);
-  }
-  
-  hstack* get_hstack() {
-    return hs;
+// Copy the frames of a captured stack and of its shared segments into one buffer 
+// and release the segments; a cold resumption is compressed or spilled as a whole.
+static void cstack_unshare(ref cstack* cs) {
+  if (cs->shared == NULL) return;
+  const byte* top = (const byte*)cstack_top(cs);
+  const byte* bottom = (const byte*)cstack_bottom(cs);
+  const byte* lo = _min(top, bottom);
+  count size = stack_diff(top, bottom);
+  byte* frames = (byte*)object_malloc(LH_OBJ_CSTACK, size);
+  if (cs->frames != NULL) memcpy(frames + (cstack_base(cs) - lo), cs->frames, cs->size);
+  const csegment* seg;
+  for (seg = cs->shared; seg != NULL; seg = seg->cstack.shared) {
+    if (seg->cstack.size > 0) memcpy(frames + (cstack_base(&seg->cstack) - lo), seg->cstack.frames, seg->cstack.size);
   }
-};
-#define LH_INIT(hs)   { _raii_hstack_init __init(hs); 
-#define LH_DONE(hs)     assert(__init.get_hstack() == hs); }
-#else
-#define LH_INIT(hs)   { bool __init = lh_init(hs);
-#define LH_DONE(hs)   if (__init) lh_done(hs); }
-#endif
+  cstack_free(cs);
+  cs->base = lo;
+  cs->size = size;
+  cs->frames = frames;
+}
 
+// Before restoring resumption `r`: split its stack in segments if it can be resumed again, and
+// remember its segments so stacks captured while running the resumption can share them.
+static void resume_share_cstack(resume* r) {
+  if (r->refcount > 1) cstack_freeze(&r->cstack);
+  csegment* parent = (r->cstack.shared != NULL ? csegment_acquire(r->cstack.shared) : NULL);
+  if (__cstack_parent != NULL) csegment_release(__cstack_parent);
+  __cstack_parent = parent;
+}
+
+// Return the topmost segment of `seg` such that it and all segments below it
+// are unchanged on the current stack and below `top`; returns `NULL` if there is none.
+static csegment* csegment_shareable(csegment* seg, const void* top) {
+  csegment* shared = seg;
+  csegment* s;
+  for (s = seg; s != NULL; s = s->cstack.shared) {
+    if (stack_isbelow(top, cstack_top(&s->cstack)) ||
+        memcmp(s->cstack.frames, s->cstack.base, s->cstack.size) != 0) {
+      shared = s->cstack.shared;  // this segment and all above it cannot be shared
+    }
+  }
+  return shared;
+}
 
 
 /*-----------------------------------------------------------------
-  Internal: Jump to a context
+  Deduplicating captured stacks
+
+  Many resumptions suspended at the same place have identical
+  frames in their captured stack (like an event loop or request 
+  dispatcher). When enabled with `lh_set_dedup`, the captured stack 
+  of a general resumption is split in chunks (aligned at 
+  `LH_DEDUP_CHUNK`) that are looked up in a per-thread hash table: 
+  a chunk with the same address and contents is shared with the
+  segment that holds it instead of stored again. Runs of consecutive
+  chunks that are new, or that are shared with the same segment, 
+  become a single segment. The new chunks are added to the table 
+  as long as their segment is alive.
 -----------------------------------------------------------------*/
 
-// `_jumpto_stack` jumps to a given entry with a given c-stack to restore.
-// It is called from `jumpto` which ensures through an `alloca` that it will
+#define LH_DEDUP_CHUNK  (4096)
+
+static bool dedup_enabled = false;
+
+// The dedup table: a hash table of the live chunks.
+static __thread cchunk** __dedup_table = NULL;
+static __thread count    __dedup_buckets = 0;
+static __thread count    __dedup_count = 0;
+
+void lh_set_dedup(bool enable) {
+  dedup_enabled = enable;
+}
+
+// Hash of the frames at `base`.
+static uintptr_t dedup_hash(const void* base, count size, const byte* frames) {
+  uint64_t h = (uint64_t)(uintptr_t)base ^ (uint64_t)size;
+  count i;
+  for (i = 0; i + 8 <= size; i += 8) {
+    uint64_t w;
+    memcpy(&w, frames + i, 8);
+    h = (h ^ w) * 0x9E3779B97F4A7C15ULL;
+    h ^= (h >> 29);
+  }
+  for (; i < size; i++) {
+    h = (h ^ frames[i]) * 0x9E3779B97F4A7C15ULL;
+  }
+  return (uintptr_t)h;
+}
+
+// Grow the dedup table.
+static void dedup_grow() {
+  count newbuckets = (__dedup_buckets == 0 ? 64 : 2*__dedup_buckets);
+  cchunk** table = (cchunk**)checked_malloc(newbuckets * sizeof(cchunk*));
+  memset(table, 0, newbuckets * sizeof(cchunk*));
+  count i;
+  for (i = 0; i < __dedup_buckets; i++) {
+    cchunk* chunk = __dedup_table[i];
+    while (chunk != NULL) {
+      cchunk* next = chunk->hnext;
+      count b = (count)(chunk->hash % (uintptr_t)newbuckets);
+      chunk->hnext = table[b];
+      table[b] = chunk;
+      chunk = next;
+    }
+  }
+  if (__dedup_table != NULL) checked_free(__dedup_table);
+  __dedup_table = table;
+  __dedup_buckets = newbuckets;
+}
+
+// Add a chunk to the dedup table.
+static void dedup_insert(cchunk* chunk) {
+  if (__dedup_count >= __dedup_buckets) dedup_grow();
+  count b = (count)(chunk->hash % (uintptr_t)__dedup_buckets);
+  chunk->hnext = __dedup_table[b];
+  __dedup_table[b] = chunk;
+  __dedup_count++;
+}
+
+// Remove the chunks of a segment that is freed from the dedup table and free them.
+static void dedup_remove(cchunk* chunks) {
+  while (chunks != NULL) {
+    cchunk* chunk = chunks;
+    chunks = chunk->next;
+    cchunk** pchunk = &__dedup_table[chunk->hash % (uintptr_t)__dedup_buckets];
+    while (*pchunk != chunk) {
+      assert(*pchunk != NULL);
+      pchunk = &(*pchunk)->hnext;
+    }
+    *pchunk = chunk->hnext;
+    object_free(LH_OBJ_CSTACK, chunk);
+    __dedup_count--;
+  }
+  if (__dedup_count == 0) {
+    checked_free(__dedup_table);
+    __dedup_table = NULL;
+    __dedup_buckets = 0;
+  }
+}
+
+// Return a chunk in the dedup table with the same `frames` at `base`, or `NULL` if there is none.
+static cchunk* dedup_find(uintptr_t hash, const void* base, count size, const byte* frames) {
+  if (__dedup_table == NULL) return NULL;
+  cchunk* chunk = __dedup_table[hash % (uintptr_t)__dedup_buckets];
+  while (chunk != NULL) {
+    if (chunk->hash == hash && chunk->base == base && chunk->size == size && memcmp(chunk->frames, frames, size) == 0) {
+      return chunk;
+    }
+    chunk = chunk->hnext;
+  }
+  return NULL;
+}
+
+// A run of consecutive chunks of a captured stack that becomes one segment.
+typedef struct _dedup_run {
+  const byte* lo;       // lowest address of the run (`lo == hi` if the run is empty)
+  const byte* hi;       // highest address of the run
+  csegment*   owner;    // the segment that holds the frames of a shared run, or `NULL` for a run of new chunks
+  const byte* frames;   // the frames of `lo` inside `owner`
+  cchunk*     chunks;   // the new chunks of the run
+} dedup_run;
+
+// Add the segment of a run of `cs` (whose frames start at `lo`) on top of `below`.
+static csegment* dedup_run_segment(dedup_run* run, const cstack* cs, const byte* lo, csegment* below) {
+  if (run->lo == run->hi) return below;
+  count size = run->hi - run->lo;
+  csegment* seg;
+  if (run->owner != NULL) {
+    seg = csegment_alloc(run->lo, size, below, run->owner, run->frames);
+  }
+  else {
+    seg = csegment_alloc(run->lo, size, below, NULL, NULL);
+    memcpy(seg->cstack.frames, cs->frames + (run->lo - lo), size);
+    seg->chunks = run->chunks;
+    cchunk* chunk;
+    for (chunk = run->chunks; chunk != NULL; chunk = chunk->next) {
+      chunk->owner = seg;
+      chunk->frames = seg->cstack.frames + ((const byte*)chunk->base - run->lo);
+      dedup_insert(chunk);
+    }
+  }
+  run->lo = run->hi = NULL;
+  run->owner = NULL;
+  run->frames = NULL;
+  run->chunks = NULL;
+  return seg;
+}
+
+// Deduplicate the frames of a captured stack.
+static void cstack_dedup(ref cstack* cs) {
+  if (cs->frames == NULL) return;
+  const byte* lo = cstack_base(cs);
+  const byte* hi = lo + cs->size;
+  csegment* seg = cs->shared;                 // the segment below the current run
+  dedup_run run = { NULL, NULL, NULL, NULL, NULL };
+  const byte* p = (stackup ? lo : hi);        // bottom of the next chunk
+  while (p != (stackup ? hi : lo)) {
+    const byte* q = stack_chunk_top(p, LH_DEDUP_CHUNK, lo, hi);  // top of the next chunk
+    const byte* base = _min(p, q);
+    count size = (p < q ? q - p : p - q);
+    const byte* frames = cs->frames + (base - lo);
+    uintptr_t hash = dedup_hash(base, size, frames);
+    cchunk* found = dedup_find(hash, base, size, frames);
+    if (found != NULL) {
+      #ifdef _STATS
+      stats.rcont_captured_deduped += size;
+      #endif
+      // extend a shared run if the frames are adjacent in the same owner
+      if (run.owner != found->owner || (stackup ? run.frames + (run.hi - run.lo) != found->frames : found->frames + size != run.frames)) {
+        seg = dedup_run_segment(&run, cs, lo, seg);
+        run.owner = found->owner;
+        run.lo = run.hi = p;
+        run.frames = found->frames;
+      }
+      if (!stackup) run.frames = found->frames;
+    }
+    else {
+      if (run.owner != NULL) {
+        seg = dedup_run_segment(&run, cs, lo, seg);
+      }
+      if (run.lo == run.hi) run.lo = run.hi = p;
+      cchunk* chunk = (cchunk*)object_malloc(LH_OBJ_CSTACK, sizeof(cchunk));
+      chunk->hash = hash;
+      chunk->hnext = NULL;
+      chunk->base = base;
+      chunk->size = size;
+      chunk->owner = NULL;
+      chunk->frames = NULL;
+      chunk->next = run.chunks;
+      run.chunks = chunk;
+    }
+    if (stackup) run.hi = q; else run.lo = q;
+    p = q;
+  }
+  seg = dedup_run_segment(&run, cs, lo, seg);
+  object_free(LH_OBJ_CSTACK, cs->frames);
+  cs->frames = NULL;
+  cs->size = 0;
+  cs->base = (stackup ? hi : lo);             // the top of the shared segments
+  cs->shared = seg;
+}
+
+/*-----------------------------------------------------------------
+  Capture budget
+
+  The live captured bytes of the resumptions of a thread are tracked 
+  (the extent of their captured C stack plus their handler stack).
+  When a budget is set with `lh_set_capture_budget`, an operation
+  that would capture a resumption beyond the budget applies the
+  budget policy before capturing.
+-----------------------------------------------------------------*/
+
+static __thread count              __capture_budget = 0;
+static __thread lh_budget_policy   __capture_policy = LH_BUDGET_THROW;
+static __thread lh_budgetfun*      __capture_budgetfun = NULL;
+
+void lh_set_capture_budget(ptrdiff_t budget, lh_budget_policy policy, lh_budgetfun* fun) {
+  __capture_budget = (budget < 0 ? 0 : budget);
+  __capture_policy = policy;
+  __capture_budgetfun = fun;
+}
+
+// Count the captured bytes of a resumption in the live captured bytes.
+static void budget_acquire(resume* r, count size) {
+  r->budgeted = size;
+  __captured_live += size;
+  if (__captured_live > __captured_live_peak) __captured_live_peak = __captured_live;
+}
+
+// Called when a resumption is freed.
+static void budget_release(resume* r) {
+  __captured_live -= r->budgeted;
+  r->budgeted = 0;
+}
+
+// Called before capturing `size` bytes: apply the budget policy if it would exceed the budget.
+static void budget_check(count size) {
+  if (__capture_budget <= 0 || __captured_live + size <= __capture_budget) return;
+  #ifdef _STATS
+  stats.rcont_over_budget++;
+  #endif
+  if (__capture_policy == LH_BUDGET_CALLBACK) {
+    if (__capture_budgetfun != NULL) __capture_budgetfun(__captured_live + size, __capture_budget);
+    return;
+  }
+  if (__capture_policy == LH_BUDGET_BLOCK) {
+    // call back until enough continuations are released (or the callback gives up)
+    while (__capture_budgetfun != NULL && __capture_budgetfun(__captured_live + size, __capture_budget)) {
+      if (__captured_live + size <= __capture_budget) return;
+    }
+  }
+  lh_throw_str(ENOMEM, "captured continuations exceed the capture budget");
+}
+
+/*-----------------------------------------------------------------
+  Compressing cold resumptions
+  
+  Suspended resumptions can be kept around for a long time (for 
+  example, waiting on I/O). When enabled with `lh_set_compress_threshold`,
+  the captured C stack of a general resumption is compressed once 
+  `threshold` newer resumptions are captured on the same thread, and
+  decompressed again when it is resumed. Captured stack frames 
+  consist mostly of zeros, small integers, and (stack) pointers with
+  the same upper bits, so we use a simple word-based compressor with a 
+  direct-mapped dictionary of recently seen words. Each group of 
+  four words is preceded by a tag byte with two bits per word: 
+  - zero    : the word is zero.
+  - exact   : the word is in the dictionary; followed by a byte index.
+  - partial : the upper 48 bits are in the dictionary; followed by a
+              byte index and the lower 16 bits.
+  - miss    : followed by the full word.
+  Any trailing bytes are appended as is.
+-----------------------------------------------------------------*/
+
+// Resumptions with a smaller captured stack are not compressed.
+#define LH_COMPRESS_MINSIZE  (256)
+
+#define LH_CTAG_ZERO    (0)
+#define LH_CTAG_EXACT   (1)
+#define LH_CTAG_PARTIAL (2)
+#define LH_CTAG_MISS    (3)
+
+// Compress once this many newer resumptions are captured (0 disables compression).
+static count compress_threshold = 0;
+
+// The general resumptions that can be compressed (or spilled), in the order they were captured.
+static __thread resume* __resume_cold_first = NULL;
+static __thread resume* __resume_cold_last = NULL;
+
+// The total size of the captured stack frames of the resumptions in the list.
+static __thread count __resume_cold_size = 0;
+
+// Number of general resumptions captured on this thread.
+static __thread count __resume_captured = 0;
+
+void lh_set_compress_threshold(long threshold) {
+  compress_threshold = (threshold < 0 ? 0 : threshold);
+}
+
+// Dictionary index of a word (based on its upper 48 bits).
+static size_t compress_index(uint64_t w) {
+  return (size_t)(((w >> 16) * 0x9E3779B97F4A7C15ULL) >> 56);
+}
+
+// Maximal size of the compressed data for `size` bytes.
+static count compress_bound(count size) {
+  count n = size / 8;
+  return ((n + 3) / 4) + (n * 8) + (size % 8);
+}
+
+// Compress `size` bytes from `src` into `dst` (of at least `compress_bound(size)` bytes).
+// Returns the compressed size.
+static count compress_frames(const byte* src, count size, byte* dst) {
+  uint64_t dict[256];
+  memset(dict, 0, sizeof(dict));
+  count n = size / 8;
+  byte* p = dst;
+  byte* tags = NULL;
+  count i;
+  for (i = 0; i < n; i++) {
+    if ((i & 3) == 0) {
+      tags = p++;
+      *tags = 0;
+    }
+    uint64_t w;
+    memcpy(&w, src + i*8, 8);
+    int tag;
+    if (w == 0) {
+      tag = LH_CTAG_ZERO;
+    }
+    else {
+      size_t k = compress_index(w);
+      if (dict[k] == w) {
+        tag = LH_CTAG_EXACT;
+        *p++ = (byte)k;
+      }
+      else if ((dict[k] >> 16) == (w >> 16)) {
+        tag = LH_CTAG_PARTIAL;
+        *p++ = (byte)k;
+        *p++ = (byte)w;
+        *p++ = (byte)(w >> 8);
+        dict[k] = w;
+      }
+      else {
+        tag = LH_CTAG_MISS;
+        memcpy(p, &w, 8);
+        p += 8;
+        dict[k] = w;
+      }
+    }
+    *tags |= (byte)(tag << (2*(i & 3)));
+  }
+  memcpy(p, src + n*8, size - n*8);
+  p += size - n*8;
+  return (p - dst);
+}
+
+// Decompress into `size` bytes at `dst`.
+static void decompress_frames(const byte* src, byte* dst, count size) {
+  uint64_t dict[256];
+  memset(dict, 0, sizeof(dict));
+  count n = size / 8;
+  const byte* p = src;
+  byte tags = 0;
+  count i;
+  for (i = 0; i < n; i++) {
+    if ((i & 3) == 0) tags = *p++;
+    uint64_t w;
+    switch ((tags >> (2*(i & 3))) & 3) {
+      case LH_CTAG_ZERO: {
+        w = 0;
+        break;
+      }
+      case LH_CTAG_EXACT: {
+        w = dict[*p++];
+        break;
+      }
+      case LH_CTAG_PARTIAL: {
+        size_t k = *p++;
+        w = (dict[k] & ~((uint64_t)0xFFFF)) | (uint64_t)p[0] | ((uint64_t)p[1] << 8);
+        p += 2;
+        dict[k] = w;
+        break;
+      }
+      default: {
+        memcpy(&w, p, 8);
+        p += 8;
+        dict[compress_index(w)] = w;
+        break;
+      }
+    }
+    memcpy(dst + i*8, &w, 8);
+  }
+  memcpy(dst + n*8, p, size - n*8);
+}
+
+// Compress the captured stack frames of a resumption.
+static void resume_compress(resume* r) {
+  assert(r->compressed == NULL);
+  cstack* cs = &r->cstack;
+  if (cs->shared != NULL && stack_diff(cstack_top(cs), cstack_bottom(cs)) >= LH_COMPRESS_MINSIZE) {
+    cstack_unshare(cs);  // the segments are released once all resumptions that share them are cold
+  }
+  if (cs->frames == NULL || cs->size < LH_COMPRESS_MINSIZE) return;
+  count bound = compress_bound(cs->size);
+  byte* buf = (byte*)object_malloc(LH_OBJ_CSTACK, (size_t)bound);
+  count csize = compress_frames(cs->frames, cs->size, buf);
+  if (csize >= cs->size) {
+    object_free(LH_OBJ_CSTACK, buf);  // not worth it
+    return;
+  }
+  r->compressed = (byte*)object_realloc(LH_OBJ_CSTACK, buf, (size_t)bound, (size_t)csize);
+  object_free(LH_OBJ_CSTACK, cs->frames);
+  cs->frames = NULL;
+  #ifdef _STATS
+  stats.rcont_compressed++;
+  stats.rcont_compressed_size += cs->size;
+  stats.rcont_compressed_saved += cs->size - csize;
+  #endif
+}
+
+/*-----------------------------------------------------------------
+  Spilling cold resumptions
+  
+  When enabled with `lh_set_spill_store`, the captured C stacks of 
+  the least recently suspended resumptions are moved to a memory
+  mapped file once the total size of the captured stacks in memory 
+  exceeds the budget. They are moved back into memory when resumed.
+  Each thread has its own spill file that is unlinked right after
+  creation. Space in the file is allocated in slots of a power of
+  two size, with a free list per size.
+-----------------------------------------------------------------*/
+
+#define LH_SPILL_MINSHIFT  (8)    // smallest slot is 256 bytes
+#define LH_SPILL_CLASSES   (40)
+#define LH_SPILL_MINMAP    (1024*1024)
+
+typedef struct _spillstore {
+  int    fd;                       // the spill file (or -1)
+  byte*  map;                      // the file mapped into memory
+  count  mapsize;                  // mapped size
+  count  top;                      // slots are allocated below `top`
+  count  free[LH_SPILL_CLASSES];   // free list of slots per size class (offset+1 of the first free slot; the next one is stored in the slot)
+  count  live;                     // number of slots in use
+} spillstore;
+
+// Directory of the spill files (`NULL` if spilling is disabled), and the maximal total size of captured stacks in memory.
+static char* spill_dir = NULL;
+static count spill_budget = 0;
+
+static __thread spillstore __spill = { -1, NULL, 0, 0, { 0 }, 0 };
+
+bool lh_set_spill_store(const char* dir, size_t budget) {
+  if (spill_dir != NULL) {
+    lh_free(spill_dir);
+    spill_dir = NULL;
+  }
+  if (dir == NULL) return true;
+  #ifdef HAS_MMAP
+  spill_dir = lh_strdup(dir);
+  spill_budget = (count)budget;
+  return true;
+  #else
+  return false;
+  #endif
+}
+
+#ifdef HAS_MMAP
+// The size class of a slot of `size` bytes.
+static int spill_class(count size) {
+  int cls = 0;
+  while (((count)1 << (cls + LH_SPILL_MINSHIFT)) < size) cls++;
+  return cls;
+}
+
+// Close the spill file of this thread.
+static void spill_close() {
+  if (__spill.map != NULL) munmap(__spill.map, (size_t)__spill.mapsize);
+  if (__spill.fd >= 0) close(__spill.fd);
+  memset(&__spill, 0, sizeof(spillstore));
+  __spill.fd = -1;
+}
+
+// Allocate a slot for `size` bytes; returns the offset in the spill file or -1 on failure.
+static count spill_alloc(count size) {
+  int cls = spill_class(size);
+  if (cls >= LH_SPILL_CLASSES) return -1;
+  count slotsize = (count)1 << (cls + LH_SPILL_MINSHIFT);
+  count ofs;
+  if (__spill.free[cls] != 0) {
+    ofs = __spill.free[cls] - 1;
+    memcpy(&__spill.free[cls], __spill.map + ofs, sizeof(count));
+  }
+  else {
+    if (__spill.fd < 0) {
+      if (spill_dir == NULL) return -1;
+      size_t n = strlen(spill_dir);
+      char* path = (char*)checked_malloc(n + 32);
+      memcpy(path, spill_dir, n);
+      strcpy(path + n, "/lh-spill-XXXXXX");
+      __spill.fd = mkstemp(path);
+      if (__spill.fd >= 0) unlink(path);  // removed once closed
+      checked_free(path);
+      if (__spill.fd < 0) return -1;
+    }
+    if (__spill.top + slotsize > __spill.mapsize) {
+      // grow the file and map it again
+      count newsize = (__spill.mapsize < LH_SPILL_MINMAP ? LH_SPILL_MINMAP : 2*__spill.mapsize);
+      while (newsize < __spill.top + slotsize) newsize *= 2;
+      if (ftruncate(__spill.fd, (off_t)newsize) != 0) return -1;
+      void* map = mmap(NULL, (size_t)newsize, PROT_READ | PROT_WRITE, MAP_SHARED, __spill.fd, 0);
+      if (map == MAP_FAILED) return -1;
+      if (__spill.map != NULL) munmap(__spill.map, (size_t)__spill.mapsize);
+      __spill.map = (byte*)map;
+      __spill.mapsize = newsize;
+    }
+    ofs = __spill.top;
+    __spill.top += slotsize;
+  }
+  __spill.live++;
+  return ofs;
+}
+
+// Free a slot of `size` bytes at offset `ofs`.
+static void spill_free(count ofs, count size) {
+  assert(__spill.live > 0);
+  __spill.live--;
+  if (__spill.live == 0) {
+    spill_close();  // give back the disk space
+    return;
+  }
+  int cls = spill_class(size);
+  memcpy(__spill.map + ofs, &__spill.free[cls], sizeof(count));
+  __spill.free[cls] = ofs + 1;
+}
+
+// Move the captured stack frames of a resumption to the spill store; returns `false` on failure.
+static bool resume_spill(resume* r) {
+  cstack* cs = &r->cstack;
+  cstack_unshare(cs);
+  if (cs->frames == NULL || cs->size == 0) return true;
+  count ofs = spill_alloc(cs->size);
+  if (ofs < 0) return false;
+  memcpy(__spill.map + ofs, cs->frames, cs->size);
+  object_free(LH_OBJ_CSTACK, cs->frames);
+  cs->frames = NULL;
+  r->spilled = ofs + 1;
+  r->spillstore = &__spill;
+  #ifdef _STATS
+  stats.rcont_spilled++;
+  stats.rcont_spilled_size += cs->size;
+  #endif
+  return true;
+}
+
+// Move the captured stack frames of a spilled resumption back into memory.
+static void resume_unspill(resume* r) {
+  cstack* cs = &r->cstack;
+  count ofs = r->spilled - 1;
+  cs->frames = (byte*)object_malloc(LH_OBJ_CSTACK, cs->size);
+  memcpy(cs->frames, __spill.map + ofs, cs->size);
+  r->spilled = 0;
+  spill_free(ofs, cs->size);
+  #ifdef _STATS
+  stats.rcont_unspilled++;
+  #endif
+}
+
+#ifndef NDEBUG
+// Spilled frames can only be read by the thread that spilled them.
+static bool spill_owned(const resume* r) {
+  return (r->spilled == 0 || r->spillstore == &__spill);
+}
+#endif
+
+// Copy the captured stack frames of a spilled resumption to `dst` (leaving it spilled).
+static void resume_spilled_copy(const resume* r, byte* dst) {
+  memcpy(dst, __spill.map + (r->spilled - 1), r->cstack.size);
+}
+#else
+static bool resume_spill(resume* r) { unreferenced(r); return false; }
+static void resume_unspill(resume* r) { unreferenced(r); }
+static void resume_spilled_copy(const resume* r, byte* dst) { unreferenced(r); unreferenced(dst); }
+#ifndef NDEBUG
+static bool spill_owned(const resume* r) { return (r->spilled == 0); }
+#endif
+static void spill_free(count ofs, count size) { unreferenced(ofs); unreferenced(size); }
+#endif
+
+
+/*-----------------------------------------------------------------
+  Parking cold resumptions
+-----------------------------------------------------------------*/
+
+// Remove a resumption from the list of compression candidates.
+static void resume_cold_remove(resume* r) {
+  if (r->cold_prev == NULL && __resume_cold_first != r) return; // not in the list
+  if (r->cold_prev != NULL) r->cold_prev->cold_next = r->cold_next;
+                       else __resume_cold_first = r->cold_next;
+  if (r->cold_next != NULL) r->cold_next->cold_prev = r->cold_prev;
+                       else __resume_cold_last = r->cold_prev;
+  r->cold_prev = r->cold_next = NULL;
+  __resume_cold_size -= r->cstack.size;
+}
+
+// Add a resumption at the end of the list of compression candidates (as captured now).
+static void resume_cold_link(resume* r) {
+  if (compress_threshold <= 0 && spill_dir == NULL) return;
+  if (r->cstack.frames == NULL && r->cstack.shared == NULL) return;  // nothing to compress or spill
+  assert(r->cold_prev == NULL && r->cold_next == NULL && __resume_cold_first != r);
+  r->captured_at = __resume_captured;
+  r->cold_next = NULL;
+  r->cold_prev = __resume_cold_last;
+  if (__resume_cold_last != NULL) __resume_cold_last->cold_next = r;
+                             else __resume_cold_first = r;
+  __resume_cold_last = r;
+  __resume_cold_size += r->cstack.size;
+}
+
+// Called for each newly captured general resumption: add it to the list of compression 
+// candidates, compress the resumptions that are now cold, and spill the least recently 
+// captured ones if the captured stacks exceed the spill budget.
+static void resume_cold_add(resume* r) {
+  __resume_captured++;
+  resume_cold_link(r);
+  if (compress_threshold > 0) {
+    while (__resume_cold_first != NULL && __resume_cold_first->captured_at + compress_threshold <= __resume_captured) {
+      resume* cold = __resume_cold_first;
+      resume_cold_remove(cold);
+      resume_compress(cold);
+    }
+  }
+  if (spill_dir != NULL) {
+    while (__resume_cold_size > spill_budget && __resume_cold_first != r) {
+      resume* cold = __resume_cold_first;
+      resume_cold_remove(cold);
+      if (!resume_spill(cold)) break;
+    }
+  }
+}
+
+// Make sure the captured stack of a resumption is in memory and not compressed (and no longer a candidate)
+static void resume_thaw(resume* r) {
+  assert(spill_owned(r));  // resumed on another thread than the one it was spilled on
+  resume_cold_remove(r);
+  if (r->spilled != 0) {
+    resume_unspill(r);
+  }
+  else if (r->compressed != NULL) {
+    cstack* cs = &r->cstack;
+    cs->frames = (byte*)object_malloc(LH_OBJ_CSTACK, cs->size);
+    decompress_frames(r->compressed, cs->frames, cs->size);
+    object_free(LH_OBJ_CSTACK, r->compressed);
+    r->compressed = NULL;
+    #ifdef _STATS
+    stats.rcont_decompressed++;
+    #endif
+  }
+}
+
+// Called when a resumption is freed.
+static void resume_cold_free(resume* r) {
+  assert(spill_owned(r));  // released on another thread than the one it was spilled on
+  resume_cold_remove(r);
+  if (r->spilled != 0) {
+    spill_free(r->spilled - 1, r->cstack.size);
+    r->spilled = 0;
+    r->cstack.size = 0;
+  }
+  else if (r->compressed != NULL) {
+    object_free(LH_OBJ_CSTACK, r->compressed);
+    r->compressed = NULL;
+    r->cstack.size = 0;
+  }
+}
+
+/*-----------------------------------------------------------------
+  Side stack: a small per-thread stack on which a captured 
+  stack is restored (see `jumpto`)
+-----------------------------------------------------------------*/
+#if defined(ASM_HAS_CALLONSTACK)
+#define LH_SIDE_STACK_SIZE  (64*1024)
+
+static __thread byte* __side_stack = NULL;
+
+// Return the (16-byte aligned) initial stack pointer of the side stack
+static void* side_stack_sp(void) {
+  if (__side_stack == NULL) __side_stack = (byte*)checked_malloc(LH_SIDE_STACK_SIZE);
+  byte* sp = (stackup ? __side_stack + 15 : __side_stack + LH_SIDE_STACK_SIZE);
+  return (void*)((uintptr_t)sp & ~((uintptr_t)15));
+}
+#endif
+
+static void side_stack_free(void) {
+  #if defined(ASM_HAS_CALLONSTACK)
+  if (__side_stack != NULL) {
+    checked_free(__side_stack);
+    __side_stack = NULL;
+  }
+  #endif
+}
+
+/*-----------------------------------------------------------------
+  Initialize globals
+-----------------------------------------------------------------*/
+
+static bool initialized = false;
+static struct exn_frame* exn_bottom = NULL;
+
+// Are the dedicated copy kernels enabled? (-1 if not chosen by the user yet)
+static int copy_kernels_enabled = -1;
+
+// Forward
+static const char* copy_kernels_select(bool enable);
+
+static __noinline bool _lh_init(hstack* hs) {
+  if (!initialized) {
+    initialized = true;
+    infer_stackdir();
+    if (copy_kernels_enabled < 0) copy_kernels_select(true);  // unless the user chose already
+    exn_bottom = _lh_get_exn_top();
+    if (exn_bottom != NULL) {
+      // find the outermost exception handler (on win32, the chain is stopped with a -1)      
+      while (exn_bottom->previous != NULL && exn_bottom->previous != (struct exn_frame*)(-1)) {
+        exn_bottom = exn_bottom->previous;
+      }
+    }
+  }
+  stackbottom = get_stack_top(); // in debug mode we use this to check if operation arguments are not passed on the stack
+  assert(__hstack.size==0 && hs == &__hstack);
+  hstack_init(hs);
+  return true;
+}
+
+#ifndef NDEBUG
+// Does this thread have handler stacks or continuations that are allocated?
+static bool thread_has_buffers(void) {
+  return (__hstack.size != 0 || __resumes_live != NULL || __fragments_live != NULL);
+}
+#endif
+
+static bool lh_init(hstack* hs) {
+  if (hs->size!=0) return false;
+              else return _lh_init(hs);
+}
+
+static __noinline void lh_done(hstack* hs) {
+  assert(hs == &__hstack && hs->size>0 && hs->count==0 && (byte*)hs->top==&hs->hframes[0]);
+  hstack_free(hs,true);
+  cstack_free(&__cstack_spare);
+  side_stack_free();
+  if (__cstack_parent != NULL) {
+    csegment_release(__cstack_parent);
+    __cstack_parent = NULL;
+  }
+}
+
+#ifdef __cplusplus
+class _raii_hstack_init {
+private:
+  bool init;
+  hstack* hs;
+public:
+  _raii_hstack_init(hstack* _hs) {
+    hs = _hs;
+    init = lh_init(hs);
+  }
+  ~_raii_hstack_init() {
+    if (init) lh_done(hs);
+  }
+  
+  hstack* get_hstack() {
+    return hs;
+  }
+};
+#define LH_INIT(hs)   { _raii_hstack_init __init(hs); 
+#define LH_DONE(hs)     assert(__init.get_hstack() == hs); }
+#else
+#define LH_INIT(hs)   { bool __init = lh_init(hs);
+#define LH_DONE(hs)   if (__init) lh_done(hs); }
+#endif
+
+
+
+/*-----------------------------------------------------------------
+  Stack copy kernels
+
+  Captured stacks are copied with dedicated kernels that are 
+  selected at runtime: AVX-512 or AVX2 on x64, and NEON on arm64 
+  (falling back to `memcpy`). Captures of at least 
+  `LH_COPY_NT_THRESHOLD` bytes use non-temporal stores on x64 as 
+  the captured copy is usually not read until much later and should 
+  not evict the (hot) stack from the cache. Restoring a stack always 
+  uses normal stores as the stack is used right after.
+-----------------------------------------------------------------*/
+
+#define LH_COPY_NT_THRESHOLD  (64*1024)
+
+typedef void lh_copyfun(void* dst, const void* src, size_t size);
+
+static void copy_memcpy(void* dst, const void* src, size_t size) {
+  memcpy(dst, src, size);
+}
+
+#if defined(LH_COPY_X64)
+__attribute__((target("avx2")))
+static void copy_avx2(void* dst, const void* src, size_t size) {
+  byte* d = (byte*)dst;
+  const byte* s = (const byte*)src;
+  while (size >= 128) {
+    __m256i x0 = _mm256_loadu_si256((const __m256i*)(s));
+    __m256i x1 = _mm256_loadu_si256((const __m256i*)(s + 32));
+    __m256i x2 = _mm256_loadu_si256((const __m256i*)(s + 64));
+    __m256i x3 = _mm256_loadu_si256((const __m256i*)(s + 96));
+    _mm256_storeu_si256((__m256i*)(d), x0);
+    _mm256_storeu_si256((__m256i*)(d + 32), x1);
+    _mm256_storeu_si256((__m256i*)(d + 64), x2);
+    _mm256_storeu_si256((__m256i*)(d + 96), x3);
+    s += 128; d += 128; size -= 128;
+  }
+  while (size >= 32) {
+    _mm256_storeu_si256((__m256i*)d, _mm256_loadu_si256((const __m256i*)s));
+    s += 32; d += 32; size -= 32;
+  }
+  if (size > 0) memcpy(d, s, size);
+}
+
+__attribute__((target("avx2")))
+static void copy_avx2_nt(void* dst, const void* src, size_t size) {
+  byte* d = (byte*)dst;
+  const byte* s = (const byte*)src;
+  size_t head = (32 - ((uintptr_t)d & 31)) & 31;  // align the destination for streaming stores
+  if (head > size) head = size;
+  memcpy(d, s, head);
+  s += head; d += head; size -= head;
+  while (size >= 128) {
+    __m256i x0 = _mm256_loadu_si256((const __m256i*)(s));
+    __m256i x1 = _mm256_loadu_si256((const __m256i*)(s + 32));
+    __m256i x2 = _mm256_loadu_si256((const __m256i*)(s + 64));
+    __m256i x3 = _mm256_loadu_si256((const __m256i*)(s + 96));
+    _mm256_stream_si256((__m256i*)(d), x0);
+    _mm256_stream_si256((__m256i*)(d + 32), x1);
+    _mm256_stream_si256((__m256i*)(d + 64), x2);
+    _mm256_stream_si256((__m256i*)(d + 96), x3);
+    s += 128; d += 128; size -= 128;
+  }
+  while (size >= 32) {
+    _mm256_stream_si256((__m256i*)d, _mm256_loadu_si256((const __m256i*)s));
+    s += 32; d += 32; size -= 32;
+  }
+  _mm_sfence();
+  if (size > 0) memcpy(d, s, size);
+}
+
+__attribute__((target("avx512f")))
+static void copy_avx512(void* dst, const void* src, size_t size) {
+  byte* d = (byte*)dst;
+  const byte* s = (const byte*)src;
+  while (size >= 256) {
+    __m512i x0 = _mm512_loadu_si512((const void*)(s));
+    __m512i x1 = _mm512_loadu_si512((const void*)(s + 64));
+    __m512i x2 = _mm512_loadu_si512((const void*)(s + 128));
+    __m512i x3 = _mm512_loadu_si512((const void*)(s + 192));
+    _mm512_storeu_si512((void*)(d), x0);
+    _mm512_storeu_si512((void*)(d + 64), x1);
+    _mm512_storeu_si512((void*)(d + 128), x2);
+    _mm512_storeu_si512((void*)(d + 192), x3);
+    s += 256; d += 256; size -= 256;
+  }
+  while (size >= 64) {
+    _mm512_storeu_si512((void*)d, _mm512_loadu_si512((const void*)s));
+    s += 64; d += 64; size -= 64;
+  }
+  if (size > 0) memcpy(d, s, size);
+}
+
+__attribute__((target("avx512f")))
+static void copy_avx512_nt(void* dst, const void* src, size_t size) {
+  byte* d = (byte*)dst;
+  const byte* s = (const byte*)src;
+  size_t head = (64 - ((uintptr_t)d & 63)) & 63;  // align the destination for streaming stores
+  if (head > size) head = size;
+  memcpy(d, s, head);
+  s += head; d += head; size -= head;
+  while (size >= 256) {
+    __m512i x0 = _mm512_loadu_si512((const void*)(s));
+    __m512i x1 = _mm512_loadu_si512((const void*)(s + 64));
+    __m512i x2 = _mm512_loadu_si512((const void*)(s + 128));
+    __m512i x3 = _mm512_loadu_si512((const void*)(s + 192));
+    _mm512_stream_si512((__m512i*)(d), x0);
+    _mm512_stream_si512((__m512i*)(d + 64), x1);
+    _mm512_stream_si512((__m512i*)(d + 128), x2);
+    _mm512_stream_si512((__m512i*)(d + 192), x3);
+    s += 256; d += 256; size -= 256;
+  }
+  while (size >= 64) {
+    _mm512_stream_si512((__m512i*)d, _mm512_loadu_si512((const void*)s));
+    s += 64; d += 64; size -= 64;
+  }
+  _mm_sfence();
+  if (size > 0) memcpy(d, s, size);
+}
+#elif defined(LH_COPY_NEON)
+// note: there are no intrinsics for non-temporal stores (`stnp`) so this is used for both.
+static void copy_neon(void* dst, const void* src, size_t size) {
+  uint8_t* d = (uint8_t*)dst;
+  const uint8_t* s = (const uint8_t*)src;
+  while (size >= 64) {
+    uint8x16_t x0 = vld1q_u8(s);
+    uint8x16_t x1 = vld1q_u8(s + 16);
+    uint8x16_t x2 = vld1q_u8(s + 32);
+    uint8x16_t x3 = vld1q_u8(s + 48);
+    vst1q_u8(d, x0);
+    vst1q_u8(d + 16, x1);
+    vst1q_u8(d + 32, x2);
+    vst1q_u8(d + 48, x3);
+    s += 64; d += 64; size -= 64;
+  }
+  while (size >= 16) {
+    vst1q_u8(d, vld1q_u8(s));
+    s += 16; d += 16; size -= 16;
+  }
+  if (size > 0) memcpy(d, s, size);
+}
+#endif
+
+// The selected kernels for normal copies and for large captures.
+static lh_copyfun* copy_kernel = &copy_memcpy;
+static lh_copyfun* copy_kernel_nt = &copy_memcpy;
+static const char* copy_kernel_name = "memcpy";
+
+static const char* copy_kernels_select(bool enable) {
+  copy_kernel = copy_kernel_nt = &copy_memcpy;
+  copy_kernel_name = "memcpy";
+  if (!enable) return copy_kernel_name;
+  #if defined(LH_COPY_X64)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    copy_kernel = &copy_avx512;
+    copy_kernel_nt = &copy_avx512_nt;
+    copy_kernel_name = "avx512";
+  }
+  else if (__builtin_cpu_supports("avx2")) {
+    copy_kernel = &copy_avx2;
+    copy_kernel_nt = &copy_avx2_nt;
+    copy_kernel_name = "avx2";
+  }
+  #elif defined(LH_COPY_NEON)
+  copy_kernel = copy_kernel_nt = &copy_neon;
+  copy_kernel_name = "neon";
+  #endif
+  return copy_kernel_name;
+}
+
+const char* lh_set_copy_kernels(bool enable) {
+  copy_kernels_enabled = (enable ? 1 : 0);
+  return copy_kernels_select(enable);
+}
+
+// Copy a captured stack
+static void cstack_copy(void* dst, const void* src, ptrdiff_t size) {
+  if (size >= LH_COPY_NT_THRESHOLD) copy_kernel_nt(dst, src, (size_t)size);
+                               else copy_kernel(dst, src, (size_t)size);
+}
+
+
+/*-----------------------------------------------------------------
+  Internal: Jump to a context
+-----------------------------------------------------------------*/
+
+// `_jumpto_stack` jumps to a given entry with a given c-stack to restore.
+// It is called from `jumpto` which ensures through an `alloca` that it will
 // run in a stack frame just above the stack we are restoring (so the local 
 // variables will remain in-tact. The `no_opt` parameter is there so 
 // smart compilers (i.e. clang) will not optimize away the `alloca` in `jumpto`.
 static __noinline __noreturn void _jumpto_stack(
-  byte* cframes, ptrdiff_t size, byte* base,
-  lh_jmp_buf* entry, bool freecframes, struct exn_frame* exnframe, byte* no_opt )
+  byte* cframes, ptrdiff_t size, byte* base, const csegment* shared,
+  lh_jmp_buf* entry, bool light, bool freecframes, struct exn_frame* exnframe, byte* no_opt )
 {
   if (no_opt != NULL) no_opt[0] = 0;
   // copy the saved stack onto our stack
-  memcpy(base, cframes, size);         // this will not overwrite our stack frame 
-  if (freecframes) { free(cframes); }  // should be fine to call `free` (assuming it will not mess with the stack above its frame)
+  if (size > 0) copy_kernel(base, cframes, (size_t)size);  // this will not overwrite our stack frame 
+  while (shared != NULL) {
+    copy_kernel((byte*)shared->cstack.base, shared->cstack.frames, (size_t)shared->cstack.size);
+    shared = shared->cstack.shared;
+  }
+  if (freecframes) { object_free(LH_OBJ_CSTACK, cframes); }  // should be fine to call `free` (assuming it will not mess with the stack above its frame)
   // and jump 
   // _lh_longjmp_chain(*entry, cstack_bottom(&cs), exnframe);
   if (exnframe != NULL) {
     assert(stack_isbelow(exn_bottom, exnframe));
     exnframe->previous = exn_bottom;
   }
-  _lh_longjmp(*entry, 1);
+  if (light) _lh_longjmp_light(*entry, 1);
+        else _lh_longjmp(*entry, 1);
 }
 
+#if defined(ASM_HAS_CALLONSTACK)
+// The arguments of `_jumpto_stack` when it is called on the side stack; 
+// these cannot be on our own stack as it is overwritten by the restore.
+typedef struct _restore_args {
+  byte*             cframes;
+  ptrdiff_t         size;
+  byte*             base;
+  const csegment*   shared;
+  lh_jmp_buf*       entry;
+  bool              light;
+  bool              freecframes;
+  struct exn_frame* exnframe;
+} restore_args;
+
+static __thread restore_args __restore_args;
+
+static __noinline __noreturn void _jumpto_side_stack(void* arg) {
+  const restore_args* ra = (const restore_args*)arg;
+  _jumpto_stack(ra->cframes, ra->size, ra->base, ra->shared, ra->entry, ra->light, ra->freecframes, ra->exnframe, NULL);
+}
+#endif
+
 /* jump to `entry` while restoring cstack `cs` and pushing handlers `hs` onto the global handler stack.
+   Set `light` if the entry was saved with `_lh_setjmp_light`.
    Set `freecframes` to `true` to release the cstack after jumping.
 */
 static __noinline __noreturn void jumpto(
-  cstack* cs, lh_jmp_buf* entry, bool freecframes, struct exn_frame* exnframe ) 
+  cstack* cs, lh_jmp_buf* entry, bool light, bool freecframes, struct exn_frame* exnframe ) 
 {
-  if (cs->frames == NULL) {
+  if (cstack_empty(cs)) {
     // if no stack, just jump back down the stack; 
     // sanity: check if the entry is really below us!
     assert(exnframe==NULL);
@@ -1329,24 +3133,45 @@ static __noinline __noreturn void jumpto(
       fatal(EFAULT,"Trying to jump up the stack to a scope that was already exited!");
     }
     // long jump back down direcly, no need to restore stacks
-    _lh_longjmp(*entry, 1);
+    if (light) _lh_longjmp_light(*entry, 1);
+          else _lh_longjmp(*entry, 1);
   }
   else {
-    // ensure there is enough room on the stack; 
     void* top = get_stack_top();
+    assert(!freecframes || cs->shared == NULL);
+    #if defined(ASM_HAS_CALLONSTACK)
+    if (stack_diff(cstack_top(cs), top) > 0) {
+      // the restored stack overlaps our stack frame: instead of growing our stack out of the way
+      // we copy the stack and jump to the entry from the side stack
+      restore_args* ra = &__restore_args;
+      ra->cframes = cs->frames;
+      ra->size = cs->size;
+      ra->base = (byte*)cstack_base(cs);
+      ra->shared = cs->shared;
+      ra->entry = entry;
+      ra->light = light;
+      ra->freecframes = freecframes;
+      ra->exnframe = exnframe;
+      _lh_callonstack(side_stack_sp(), &_jumpto_side_stack, ra);
+    }
+    #endif
+    // ensure there is enough room on the stack; 
     ptrdiff_t extra = stack_diff(cstack_top(cs), top);                     
-    extra += 0x200; // ensure a little more for the `_jumpto_stack` stack frame
+    extra += LH_STACK_SLACK; // ensure the `_jumpto_stack` stack frame is above the restored stack
                     // clang tends to optimize out a bare `alloca` call so we need to 
                     //  ensure it sees it as live; we store it in a local and pass that to `_jumpto_stack`
     byte* no_opt = NULL;
     if (extra > 0) {
       no_opt = (byte*)lh_alloca(extra); // allocate room on the stack; in here the new stack will get copied.
+      #ifdef _STATS
+      stats.rcont_restore_reserved += extra;
+      #endif
     }
     // since we allocated more, the execution of `_jumpto_stack` will be in a stack frame 
     // that will not get overwritten itself when copying the new stack
     // void* exnframe = (resuming ? _lh_get_exn_frame(cstack_bottom(cs)) : NULL);
-    _jumpto_stack(cs->frames, cs->size, (byte*)cstack_base(cs),
-                  entry, freecframes, exnframe, no_opt);
+    _jumpto_stack(cs->frames, cs->size, (byte*)cstack_base(cs), cs->shared,
+                  entry, light, freecframes, exnframe, no_opt);
   }
 }
 
@@ -1356,13 +3181,49 @@ static __noinline __noreturn void jumpto_fragment(fragment* f, lh_value res)
 {
   assert(f->refcount >= 1);
   f->res = res; // set the argument in the cont slot  
-  jumpto(&f->cstack, &f->entry, false, NULL);
+  jumpto(&f->cstack, &f->entry, false, false, NULL);
 }
 
 
+// The resumption that is being resumed; needed at its entry point since a resumption
+// and its clones share the same entry point.
+static __thread resume* __resume_current = NULL;
+
+// jump to a resumption of a shallow handler; the handler itself is not restored but
+// if `hdef` is not `NULL` a new handler is installed in its place using its original entry point.
+static __noinline __noreturn void jumpto_resume_shallow( resume* r, const lh_handlerdef* hdef, lh_value local, lh_value arg )
+{
+  if (hdef != NULL) {
+    effecthandler* h = hstack_push_effect(&__hstack, hdef, r->hstackbase, local);
+    h->group = r->hgroup;
+    h->exn_frame = r->exn_bottom;
+    memcpy(h->entry, r->hentry, sizeof(lh_jmp_buf));
+  }
+  // first restore the hstack (which may be empty)
+  if (!hstack_empty(&r->hstack)) {
+    if (r->refcount == 1) {
+      hstack_append_movefrom(&__hstack, &r->hstack, hstack_bottom(&r->hstack));
+      hstack_free(&r->hstack, false /* no release */); // zero out the hstack in the resume since we moved it
+    }
+    else {
+      handler* h = hstack_append_copyfrom(&__hstack, &r->hstack, hstack_bottom(&r->hstack)); // does not acquire h
+      handler_acquire(h);
+    }
+  }
+  // and then restore the cstack and jump
+  r->arg = arg;         // set the argument in the cont slot  
+  r->resumptions++;     // increment resume count
+  __resume_current = r; // the resumption (or clone) that is resumed
+  jumpto(&r->cstack, &r->entry, false, false, r->exn_bottom);
+}
+
 // jump to a resumption
-static __noinline __noreturn void jumpto_resume( resume* r, lh_value local, lh_value arg )
+static __noinline __noreturn void jumpto_resume( resume* r, const lh_handlerdef* hdef, lh_value local, lh_value arg )
 {
+  resume_thaw(r);
+  resume_share_cstack(r);
+  if (r->shallow) jumpto_resume_shallow(r, hdef, local, arg);
+  assert(hdef == NULL);
   // first restore the hstack and set the new local
   handler* h = hstack_bottom(&r->hstack);
   assert(is_effecthandler(h));
@@ -1374,14 +3235,18 @@ static __noinline __noreturn void jumpto_resume( resume* r, lh_value local, lh_v
     h = hstack_append_copyfrom(&__hstack, &r->hstack, hstack_bottom(&r->hstack)); // does not acquire h
   }
   assert(is_effecthandler(h));
-  ((effecthandler*)h)->local = local; // write new local directly into the hstack
-  if (r->refcount==1) {
-    handler_acquire(h); // acquire now that the new local is in there (as it may alias the original)
+  effecthandler* eh = (effecthandler*)h;
+  lh_value old = eh->local;
+  eh->local = local;  // write new local directly into the hstack
+  handler_acquire(h); // acquire now that the new local is in there (as it may alias the original)
+  if (r->refcount==1 && eh->hdef->local_release != NULL) {
+    eh->hdef->local_release(old); // we moved the frames so we own the captured local
   }
   // and then restore the cstack and jump
   r->arg = arg;         // set the argument in the cont slot  
   r->resumptions++;     // increment resume count
-  jumpto(&r->cstack, &r->entry, false , r->exn_bottom);
+  __resume_current = r; // the resumption (or clone) that is resumed
+  jumpto(&r->cstack, &r->entry, false, false, r->exn_bottom);
 }
 
 
@@ -1393,6 +3258,7 @@ static __noinline __noreturn void jumpto_resume( resume* r, lh_value local, lh_v
 // Copy part of the C stack into a context.
 static void capture_cstack(cstack* cs, const void* bottom, const void* top)
 {
+  cs->shared = NULL;
   ptrdiff_t size = stack_diff(top, bottom);
   if (size <= 0) { // (stackdown ? top >= bottom : top <= bottom) {
     // top is not above bottom; don't capture the stack
@@ -1401,11 +3267,77 @@ static void capture_cstack(cstack* cs, const void* bottom, const void* top)
     cs->frames = NULL;
   }
   else {
-    // copy the stack 
     cs->base = (bottom <= top ? bottom : top); // always lowest address
     cs->size = size;
-    cs->frames = (byte*)checked_malloc(size);
-    memcpy(cs->frames, cs->base, size);
+    #ifdef _STATS
+    stats.rcont_captured_cstack += size;
+    #endif
+    // copy the stack 
+    cs->frames = (byte*)object_malloc(LH_OBJ_CSTACK, size);
+    cstack_copy(cs->frames, cs->base, size);
+    #ifdef _STATS
+    stats.rcont_captured_copied += size;
+    #endif
+  }
+}
+
+// The frames of the spare c-stack are compared in aligned chunks of this size.
+#define LH_SPARE_CHUNK  (1024)
+
+// Incremental capture: return a segment with the bottom frames of the spare c-stack that are 
+// still unchanged on the current stack below `top`, or `NULL` if there are none. The segment 
+// shares the frames of the spare (which becomes its owner) so the bottom is not copied again.
+// (note: we cannot rely on tracking the extent of the stack used since restoring as 
+//  frames further down can still be written through pointers, so we compare per aligned chunk)
+static csegment* cstack_spare_share(const void* bottom, const void* top) {
+  cstack* spare = &__cstack_spare;
+  if (spare->frames == NULL || cstack_bottom(spare) != bottom) return NULL;
+  const arena* a = arena_owner(spare->frames);
+  if (a != NULL && a != &__arena && a != __capture_arena) return NULL;  // never share a block out of an arena scope
+  const byte* lo = cstack_base(spare);
+  const byte* hi = lo + spare->size;
+  const byte* p = (const byte*)bottom;        // top of the unchanged frames
+  while (p != (stackup ? hi : lo)) {
+    const byte* q = stack_chunk_top(p, LH_SPARE_CHUNK, lo, hi);
+    if (stack_isbelow(top, q)) break;
+    const byte* base = _min(p, q);
+    count size = (p < q ? q - p : p - q);
+    if (memcmp(spare->frames + (base - lo), base, size) != 0) break;
+    p = q;
+  }
+  if (p == (const byte*)bottom) return NULL;
+  csegment* owner = csegment_adopt(spare);
+  const byte* base = _min(p, (const byte*)bottom);
+  count size = (p < (const byte*)bottom ? (const byte*)bottom - p : p - (const byte*)bottom);
+  csegment* seg = csegment_alloc(base, size, NULL, owner, owner->cstack.frames + (base - lo));
+  csegment_release(owner);  // now only referenced by `seg`
+  return seg;
+}
+
+// Capture part of the C stack sharing unchanged segments with the most recently resumed resumption,
+// or the unchanged bottom of the spare c-stack.
+static void capture_cstack_shared(cstack* cs, const void* bottom, const void* top) {
+  csegment* parent = __cstack_parent;
+  csegment* shared = NULL;
+  if (parent != NULL && cstack_bottom(&parent->cstack) == bottom) {
+    shared = csegment_shareable(parent, top);
+    if (shared != NULL) csegment_acquire(shared);
+  }
+  if (shared == NULL) {
+    shared = cstack_spare_share(bottom, top);
+  }
+  if (shared == NULL) {
+    capture_cstack(cs, bottom, top);
+  }
+  else {
+    const void* sharedtop = cstack_top(&shared->cstack);
+    capture_cstack(cs, sharedtop, top);
+    cs->shared = shared;
+    #ifdef _STATS
+    ptrdiff_t sharedsize = stack_diff(sharedtop, bottom);
+    stats.rcont_captured_cstack += sharedsize;
+    stats.rcont_captured_shared += sharedsize;
+    #endif
   }
 }
 
@@ -1421,6 +3353,15 @@ static void capture_hstack(hstack* hs, hstack* to, effecthandler* h, bool copy)
   }
 }
 
+// Capture the part of a handler stack above `h` (for shallow handlers).
+static void capture_hstack_above(hstack* hs, hstack* to, effecthandler* h) {
+  hstack_init(to);
+  handler* above = (handler*)((byte*)h + sizeof(effecthandler));
+  if ((byte*)above < hs->hframes + hs->count) {
+    hstack_append_movefrom(to, hs, above);
+  }
+}
+
 /*-----------------------------------------------------------------
     Yield to handler
 -----------------------------------------------------------------*/
@@ -1443,7 +3384,7 @@ static void __noinline __noreturn yield_to_handler(hstack* hs, effecthandler* h,
   h->arg = oparg;
   h->arg_op = op;
   h->arg_resume = resume;
-  jumpto(&cs, &h->entry, true, NULL);
+  jumpto(&cs, &h->entry, true, true, NULL);
 }
 
 
@@ -1470,10 +3411,11 @@ public:
 #endif
 // Call a `resume* r`. First capture a jump point and c-stack into a `fragment`
 // and push it in a fragment handler so the resume will return here later on.
-static __noinline lh_value capture_resume_call(hstack* hs, resume* r, lh_value resumelocal, lh_value resumearg)
+static __noinline lh_value capture_resume_call(hstack* hs, resume* r, const lh_handlerdef* hdef, lh_value resumelocal, lh_value resumearg)
 {
   // initialize continuation
-  fragment* f = (fragment*)checked_malloc(sizeof(fragment));
+  fragment* f = (fragment*)object_malloc(LH_OBJ_FRAGMENT, sizeof(fragment));
+  fragment_link_live(f);
   f->refcount = 1;
   f->res = lh_value_null; 
   #ifdef __cplusplus
@@ -1514,20 +3456,33 @@ static __noinline lh_value capture_resume_call(hstack* hs, resume* r, lh_value r
     // push a special "fragment" frame to remember to restore the stack when yielding to a handler across non-scoped resumes
     hstack_push_fragment(hs, f);
     // and now jump to the entry with resume arg
-    jumpto_resume(r, resumelocal, resumearg);
+    jumpto_resume(r, hdef, resumelocal, resumearg);
   }
 }
 
 // Capture a first-class resumption and yield to the handler.
 static __noinline lh_value capture_resume_yield(hstack* hs, effecthandler* h, const lh_operation* op, lh_value oparg )
 {
+  // check the capture budget (this may throw)
+  budget_check(stack_diff(get_stack_top(), h->stackbase) + ptrdiff((byte*)hs->top, (byte*)h));
+  // allocate in the arena of the handler if its `lh_handle_arena` scope is still active
+  arena* const saved_arena = __capture_arena;
+  __capture_arena = (h->arena != NULL && arena_scope_active(h->arena) ? h->arena : NULL);
   // initialize continuation
-  resume* r = (resume*)checked_malloc(sizeof(resume));
+  resume* r = (resume*)object_malloc(LH_OBJ_RESUME, sizeof(resume));
+  resume_link_live(r);
   r->lhresume.rkind = (op->opkind<=LH_OP_SCOPED ? ScopedResume : GeneralResume);
   r->refcount = 1;
   r->resumptions = 0;
   r->exn_bottom = h->exn_frame;
   r->arg = lh_value_null;
+  r->shallow = (op->opkind == LH_OP_SHALLOW);
+  r->cold_prev = r->cold_next = NULL;
+  r->captured_at = 0;
+  r->compressed = NULL;
+  r->spilled = 0;
+  r->spillstore = NULL;
+  r->budgeted = 0;
   #ifdef _STATS
   stats.rcont_captured_resume++;
   #endif    
@@ -1535,31 +3490,46 @@ static __noinline lh_value capture_resume_yield(hstack* hs, effecthandler* h, co
   if (_lh_setjmp(r->entry) != 0) {
     // longjmp back here when the resumption is called
     assert(hs == &__hstack);
-    lh_value res = r->arg;
+    // `r` is the resumption captured here but we may be resumed through a clone of it
+    resume* rr = __resume_current;
+    __resume_current = NULL;
+    lh_value res = rr->arg;
     #ifdef _STATS
     stats.rcont_resumed_resume++;
     #endif
     #ifdef __cplusplus
-    if (r->resumptions <= 0) {
-      throw lh_resume_unwind_exception(r); // unwind for a resumption that was never resumed
+    if (rr->resumptions <= 0) {
+      throw lh_resume_unwind_exception(rr); // unwind for a resumption that was never resumed
     }
     #endif
     // release our context
-    resume_release(r);
+    resume_release(rr);
     // return the result of the resume call
     return res;
   }
   else {
     // we set our jump point; now capture the stack upto the handler
     void* top = get_stack_top();
-    capture_cstack(&r->cstack, h->stackbase, top);
+    capture_cstack_shared(&r->cstack, h->stackbase, top);
+    if (dedup_enabled && r->lhresume.rkind == GeneralResume) cstack_dedup(&r->cstack);
     // capture hstack
-    capture_hstack(hs, &r->hstack, h, false );
+    if (r->shallow) {
+      capture_hstack_above(hs, &r->hstack, h);
+      memcpy(r->hentry, h->entry, sizeof(lh_jmp_buf));
+      r->hgroup = h->group;
+      r->hstackbase = h->stackbase;
+    }
+    else {
+      capture_hstack(hs, &r->hstack, h, false);
+      assert(h->hdef == ((effecthandler*)(r->hstack.hframes))->hdef); // same handler?
+    }
+    __capture_arena = saved_arena;
     #ifdef _STATS
-    if (r->cstack.frames == NULL) stats.rcont_captured_empty++;
+    if (cstack_empty(&r->cstack)) stats.rcont_captured_empty++;
     stats.rcont_captured_size += (long)r->cstack.size + (long)r->hstack.size;
     #endif
-    assert(h->hdef == ((effecthandler*)(r->hstack.hframes))->hdef); // same handler?
+    budget_acquire(r, stack_diff(top, h->stackbase) + r->hstack.count);
+    if (r->lhresume.rkind == GeneralResume) resume_cold_add(r);
     // and yield to the handler
     yield_to_handler(hs, h, r, op, oparg, false /* we moved the frames to the resumption */ );
   }
@@ -1567,9 +3537,42 @@ static __noinline lh_value capture_resume_yield(hstack* hs, effecthandler* h, co
 
 
 
-/*-----------------------------------------------------------------
-   Handle
------------------------------------------------------------------*/
+/*-----------------------------------------------------------------
+   Handle
+-----------------------------------------------------------------*/
+// Is the top of the handler stack an effect handler of `group`?
+static bool hstack_top_in_group(hstack* hs, count group) {
+  if (hstack_empty(hs)) return false;
+  handler* h = hstack_top(hs);
+  return (is_effecthandler(h) && ((effecthandler*)h)->group == group);
+}
+
+// Pop the handlers of `group` that are on top of the handler stack and apply their result functions.
+// Usually this is just one handler, but for `lh_handle_multi` the group can contain multiple handlers. 
+// These are never separated by other frames but a resumption may only contain the top ones 
+// (in which case there is a fragment frame below them).
+static lh_value hstack_pop_group(hstack* hs, count group, lh_value res) {
+  while (hstack_top_in_group(hs, group)) {
+    effecthandler* h = (effecthandler*)hstack_top(hs);
+    lh_resultfun* resfun = h->hdef->resultfun;
+    lh_value local = h->local;
+    hstack_pop(hs, true);
+    if (resfun != NULL) {
+      res = resfun(local, res);
+    }
+  }
+  return res;
+}
+
+// Copy the entry point of the top handler `h` to the other handlers in its group.
+static void hstack_share_entry(hstack* hs, effecthandler* h) {
+  handler* g = hstack_prev(hs, to_handler(h));
+  while (g != NULL && is_effecthandler(g) && ((effecthandler*)g)->group == h->group) {
+    memcpy(((effecthandler*)g)->entry, h->entry, sizeof(lh_jmp_buf));
+    g = hstack_prev(hs, g);
+  }
+}
+
 #ifdef __cplusplus
 // This class ensures a handler-stack will be properly unwound even when exceptions are raised.
 class raii_hstack_pop {
@@ -1592,121 +3595,196 @@ public:
     hstack_pop(hs, do_release);
   }
 };
+
+// This class ensures the handlers of a group are popped even when exceptions are raised.
+class raii_hstack_pop_group {
+private:
+  hstack* hs;
+  count   group;
+public:
+  raii_hstack_pop_group(hstack* hs, count group) {
+    this->hs = hs;
+    this->group = group;
+  }
+  ~raii_hstack_pop_group() {
+    while (hstack_top_in_group(hs, group)) {
+      hstack_pop(hs, true);
+    }
+  }
+};
+
+// This class ensures the local state of a popped handler is released even when exceptions are raised.
+class raii_local_release {
+private:
+  lh_releasefun* release;
+  lh_value       local;
+public:
+  raii_local_release(lh_releasefun* release, lh_value local) {
+    this->release = release;
+    this->local = local;
+  }
+  ~raii_local_release() {
+    if (release != NULL) release(local);
+  }
+};
+#endif
+
+#ifdef __cplusplus
+// Is the handler `target` one of the handlers of `group` on top of the handler stack?
+static bool hstack_group_contains(hstack* hs, count group, const effecthandler* target) {
+  if (target == NULL || target->group != group || hstack_empty(hs)) return false;
+  handler* h = hstack_top(hs);
+  while (h != NULL && is_effecthandler(h) && ((effecthandler*)h)->group == group) {
+    if (h == to_handler(target)) return true;
+    h = hstack_prev(hs, h);
+  }
+  return false;
+}
+
+// Handle an unwind exception to one of the handlers of `group`.
+static lh_value handle_unwind_group(hstack* hs, count group, const lh_unwind_exception& exn) {
+  assert(hstack_group_contains(hs, group, exn.handler));
+  // pop the handlers of the group above the target
+  while (hstack_top(hs) != to_handler(exn.handler)) {
+    hstack_pop(hs, true);
+  }
+  lh_value res = exn.res;
+  try {
+    if (exn.opfun != NULL) {
+      res = exn.opfun(NULL, exn.handler->local, res); // LH_OP_NORESUME
+    }
+    hstack_pop(hs, true);
+    // and the handlers below it
+    res = hstack_pop_group(hs, group, res);
+  }
+  catch (const lh_unwind_exception& exn2) {
+    if (!hstack_group_contains(hs, group, exn2.handler)) throw; // rethrow to other handler
+    res = handle_unwind_group(hs, group, exn2);
+  }
+  return res;
+}
 #endif
 
-// Start a handler 
+// Start a handler; `h` is the top handler of its group and all handlers
+// of the group share the same entry point.
 static __noinline lh_value handle_with(
   hstack* hs, effecthandler* h, lh_value(*action)(lh_value), lh_value arg )
 {
-  // set the handler entry point 
-  #if defined(__cplusplus) || !defined(NDEBUG)
-  const count id = h->id;
-  #endif
+  const count group = h->group;
   #ifndef NDEBUG
-  const lh_handlerdef* hdef = h->hdef;
   void* base = h->stackbase;
   #endif
-  if (_lh_setjmp(h->entry) != 0) {
-    // needed as some compilers optimize wrongly (e.g. gcc v5.4.0 x86_64 with -O2 on msys2)
-    hs = &__hstack;      
-    // we yielded back to the handler; the `handler->arg` is filled in.
-    // note: if we return trough non-scoped resumes the handler stack may be
-    // different and handler `h` will point to a random handler in that stack!
-    // ie. we need to load from the top of the current handler stack instead.
-    // This is also necessary if the handler stack was reallocated to grow.
-    h = (effecthandler*)(hstack_top(hs));  // re-load our handler
-    assert(is_effecthandler(to_handler(h)));
-    #ifndef NDEBUG
-    assert(id == h->id);
-    assert(hdef == h->hdef);
-    assert(base == h->stackbase);
-    #endif
-    lh_value  res    = h->arg;
-    lh_value  local  = h->local;
-    resume*   resume = h->arg_resume;
-    const lh_operation* op = h->arg_op;
-    assert(op == NULL || op->optag->effect == h->handler.effect);
-    hstack_pop(hs, (op==NULL) /*|| !op_is_release(op)*/ ); // no release if moved into resumption
-    if (op != NULL && op->opfun != NULL) {
-      // push a scoped frame if necessary
-      if (op->opkind >= LH_OP_SCOPED) {
-        hstack_push_scoped(hs, resume);  
-        #ifdef __cplusplus
-        raii_hstack_pop do_pop(hs, true, LH_EFFECT(__scoped));
-        #endif
-        assert((void*)&resume->lhresume == (void*)resume);
-        res = op->opfun(&resume->lhresume, local, res);
-        assert(hs==&__hstack);
-        #ifdef __cplusplus
-        // set now only now to not release; in case of an exception we always need to release (?)
-        if (op->opkind > LH_OP_SCOPED) do_pop.do_release = false;
-        #else
-        hstack_pop(hs,op->opkind==LH_OP_SCOPED);
-        #endif
-      }
-      else {
-        // and call the operation handler
-        res = op->opfun(&resume->lhresume, local, res);
+  lh_value res;
+  #ifdef __cplusplus
+  raii_hstack_pop_group do_pop(hs, group);
+  try {
+  #endif
+    // set the handler entry point 
+    if (_lh_setjmp_light(h->entry) != 0) {
+      // needed as some compilers optimize wrongly (e.g. gcc v5.4.0 x86_64 with -O2 on msys2)
+      hs = &__hstack;      
+      // we yielded back to the handler; the `handler->arg` is filled in.
+      // note: if we return trough non-scoped resumes the handler stack may be
+      // different and handler `h` will point to a random handler in that stack!
+      // ie. we need to load from the top of the current handler stack instead.
+      // This is also necessary if the handler stack was reallocated to grow.
+      // For a group, the top can be any of the handlers in the group.
+      h = (effecthandler*)(hstack_top(hs));  // re-load our handler
+      assert(is_effecthandler(to_handler(h)));
+      #ifndef NDEBUG
+      assert(group == h->group);
+      assert(base == h->stackbase);
+      #endif
+      res = h->arg;
+      lh_value  local  = h->local;
+      resume*   resume = h->arg_resume;
+      const lh_operation* op = h->arg_op;
+      assert(op == NULL || op->optag->effect == h->handler.effect);
+      // the frame of a shallow operation is not moved into the resumption but its
+      // local state is released only once the operation function is done with it
+      lh_releasefun* release = (op != NULL && op->opkind == LH_OP_SHALLOW ? h->hdef->local_release : NULL);
+      hstack_pop(hs, op==NULL /*|| !op_is_release(op)*/ ); // no release if moved into resumption
+      #ifdef __cplusplus
+      raii_local_release do_release(release, local);
+      #endif
+      if (op != NULL && op->opfun != NULL) {
+        // push a scoped frame if necessary
+        if (op->opkind >= LH_OP_SCOPED) {
+          hstack_push_scoped(hs, resume);  
+          #ifdef __cplusplus
+          raii_hstack_pop do_pop(hs, true, LH_EFFECT(__scoped));
+          #endif
+          assert((void*)&resume->lhresume == (void*)resume);
+          res = op->opfun(&resume->lhresume, local, res);
+          assert(hs==&__hstack);
+          #ifdef __cplusplus
+          // set now only now to not release; in case of an exception we always need to release (?)
+          if (op->opkind > LH_OP_SCOPED) do_pop.do_release = false;
+          #else
+          hstack_pop(hs,op->opkind==LH_OP_SCOPED);
+          #endif
+        }
+        else {
+          // and call the operation handler
+          res = op->opfun(&resume->lhresume, local, res);
+        }
       }
+      #ifndef __cplusplus
+      if (release != NULL) release(local);
+      #endif
     }
-    return res;
-  }
-  else {
-    // we set up the handler, now call the action 
-    lh_value res;
-    lh_resultfun* resfun = NULL;
-    lh_value local = lh_value_null;
-    #ifdef __cplusplus
-    {
-      raii_hstack_pop do_pop(hs, true, h->hdef->effect);
-      try {
-        #endif
-        res = action(arg);
-        assert(hs == &__hstack);
-        h = (effecthandler*)hstack_top(hs);  // re-load our handler since the handler stack could have been reallocated
-        #ifndef NDEBUG
-        assert(id == h->id);
-        assert(hdef == h->hdef);
+    else {
+      // we set up the handler, now call the action 
+      if (h->id != group) hstack_share_entry(hs, h);
+      res = action(arg);
+      assert(hs == &__hstack);
+      #ifndef NDEBUG
+      // re-load our handler since the handler stack could have been reallocated
+      // (it is not there anymore if we were resumed from a shallow handler operation)
+      if (hstack_top_in_group(hs, group)) {
+        h = (effecthandler*)hstack_top(hs);  
         assert(base == h->stackbase);
-        #endif
-        // pop our handler
-        resfun = h->hdef->resultfun;
-        local = h->local;
-        #ifndef __cplusplus
-        hstack_pop(hs, true);
-        #else
-      }
-      catch (const lh_unwind_exception& exn) {
-        if (exn.handler == NULL || exn.handler->id != id) throw; // rethrow to other handler
-        res = exn.res;
-        if (exn.opfun != NULL) {
-          res = exn.opfun(NULL, exn.handler->local, res); // LH_OP_NORESUME
-        }
       }
+      #endif
     }
-    #endif
-    if (resfun != NULL) {
-      res = resfun(local, res);
-    }
-    return res;
+    // pop our handler(s) that are still on the stack
+    res = hstack_pop_group(hs, group, res);
+  #ifdef __cplusplus
   }
+  catch (const lh_unwind_exception& exn) {
+    if (!hstack_group_contains(hs, group, exn.handler)) throw; // rethrow to other handler
+    res = handle_unwind_group(hs, group, exn);
+  }
+  #endif
+  return res;
 }
 
-// `handle_upto` installs a handler on the stack with a given stack `base`. 
-static __noinline lh_value handle_upto(hstack* hs, void* base, const lh_handlerdef* def,
-  lh_value local, lh_value(*action)(lh_value), lh_value arg)
+// `handle_upto` installs `n` handlers on the stack with a given stack `base`. 
+static __noinline lh_value handle_upto(hstack* hs, void* base, count n, const lh_handlerdef* const defs[],
+  const lh_value locals[], lh_value(*action)(lh_value), lh_value arg)
 {
-  // allocate handler frame on the stack so it will be part of a captured continuation
-  effecthandler* h = hstack_push_effect(hs, def, base, local);
+  // allocate handler frames on the stack so it will be part of a captured continuation
+  effecthandler* h = hstack_push_effect(hs, defs[0], base, (locals == NULL ? lh_value_null : locals[0]));
+  const count group = h->id;
+  count i;
+  for (i = 1; i < n; i++) {
+    h = hstack_push_effect(hs, defs[i], base, (locals == NULL ? lh_value_null : locals[i]));
+    h->group = group;
+  }
   fragment* fragment;
   lh_value res;
   #ifdef __cplusplus
   try {
-    h->exn_frame = _lh_get_exn_top();
-    assert(h->exn_frame == NULL || stack_isbelow(base, h->exn_frame));
+    struct exn_frame* exn_frame = _lh_get_exn_top();
+    assert(exn_frame == NULL || stack_isbelow(base, exn_frame));
+    handler* g = to_handler(h);
+    for (i = 0; i < n; i++, g = _handler_prev(g)) {
+      ((effecthandler*)g)->exn_frame = exn_frame;
+    }
   #endif
     res = handle_with(hs, h, action, arg);
     fragment = hstack_pop_fragment(hs);
+    hstack_shrink(hs);
   #ifdef __cplusplus
   }
   catch (...) {
@@ -1732,11 +3810,95 @@ __noinline lh_value lh_handle( const lh_handlerdef* def, lh_value local, lh_acti
   hstack* hs = &__hstack;
   lh_value res;
   LH_INIT(hs)
-  res = handle_upto(hs, &base, def, local, action, arg);
+  res = handle_upto(hs, &base, 1, &def, &local, action, arg);
+  LH_DONE(hs)
+  return res;
+}
+
+// `lh_handle_multi` installs `n` handlers at once with a single entry point. 
+// This is equivalent to nesting `lh_handle` calls where `defs[0]` is the outermost handler.
+__noinline lh_value lh_handle_multi(const lh_handlerdef* const defs[], const lh_value locals[], size_t n, lh_actionfun* action, lh_value arg)
+{
+  if (n == 0) return action(arg);
+  void* base = NULL; 
+  hstack* hs = &__hstack;
+  lh_value res;
+  LH_INIT(hs)
+  res = handle_upto(hs, &base, (count)n, defs, locals, action, arg);
   LH_DONE(hs)
   return res;
 }
 
+// Pop an `lh_handle_arena` scope; returns the number of blocks in its arena that are 
+// still in use (by resumptions the program did not release yet). Those blocks are left 
+// alone: the arena moves to the ended arenas so they are freed in it once released.
+static count arena_scope_pop(arena* a) {
+  arena** p = &__arena_scopes;
+  while (*p != NULL && *p != a) p = &(*p)->next;
+  if (*p == NULL) return 0;  // already popped
+  // the spare c-stack may still point into the arena
+  if (__cstack_spare.frames != NULL && arena_contains(a, __cstack_spare.frames)) {
+    cstack_free(&__cstack_spare);
+  }
+  *p = a->next;
+  if (a->live > 0) {
+    a->ended = true;
+    a->next = __arenas_ended;
+    __arenas_ended = a;
+  }
+  return a->live;
+}
+
+typedef struct _arena_handle_args {
+  const lh_handlerdef* def;
+  lh_value             local;
+  lh_actionfun*        action;
+  lh_value             arg;
+} arena_handle_args;
+
+static lh_value arena_handle(lh_value args) {
+  arena_handle_args* a = (arena_handle_args*)lh_ptr_value(args);
+  return lh_handle(a->def, a->local, a->action, a->arg);
+}
+
+// `lh_handle_arena` installs a handler like `lh_handle` but allocates the resumptions 
+// captured under it in the caller supplied memory `mem` of `size` bytes. 
+__noinline lh_value lh_handle_arena(void* mem, size_t size, const lh_handlerdef* def, lh_value local, lh_actionfun* action, lh_value arg)
+{
+  // the arena header is at the start of `mem`, the blocks follow 16-byte aligned
+  byte* base = (byte*)(((uintptr_t)mem + sizeof(arena) + LH_ARENA_HEADER - 1) & ~((uintptr_t)LH_ARENA_HEADER - 1));
+  if (mem == NULL || (byte*)mem + size < base + LH_ARENA_HEADER) fatal(EINVAL, "arena memory is too small: %lu", (unsigned long)size);
+  arena* a;
+  for (a = __arenas_ended; a != NULL; a = a->next) {
+    if ((byte*)a < (byte*)mem + size && (byte*)mem < a->base + a->size) lh_throw_str(EFAULT, "arena memory is still in use by resumptions of an earlier scope");
+  }
+  a = (arena*)mem;
+  memset(a, 0, sizeof(arena));
+  a->base = base;
+  a->size = ptrdiff((byte*)mem + size, base);
+  a->next = __arena_scopes;
+  __arena_scopes = a;
+  arena_handle_args args = { def, local, action, arg };
+  lh_value res;
+  lh_exception* exn = NULL;
+  count live;
+  #ifdef __cplusplus
+  try {
+  #endif
+    // pop the scope on exceptions too
+    res = lh_try_all(&exn, &arena_handle, lh_value_any_ptr(&args));
+    live = arena_scope_pop(a);
+  #ifdef __cplusplus
+  }
+  catch (...) {
+    arena_scope_pop(a);  // on unwinding
+    throw;
+  }
+  #endif
+  if (exn != NULL) lh_throw(exn);
+  if (live > 0) lh_throw_str(EFAULT, "resumptions allocated in an arena are still alive at the end of its scope");
+  return res;
+}
 
 /*-----------------------------------------------------------------
   Linear handlers only have tail resume operations that do not exit themselves.
@@ -1794,20 +3956,20 @@ lh_value _lh_implicit_get(lh_resume r, lh_value local, lh_value arg) {
   return lh_tail_resume(r, local, local);
 }
 
+// Operation for state cells (defined in libhandler.h) returns the current value of the cell.
+lh_value _lh_cell_get(lh_resume r, lh_value local, lh_value arg) {
+  (void)(arg);
+  return lh_tail_resume(r, local, *((lh_value*)lh_ptr_value(local)));
+}
+
 /*-----------------------------------------------------------------
   Yield an operation
 -----------------------------------------------------------------*/
 
-// `yieldop` yields to the first enclosing handler that can handle
-//   operation `optag` and passes it the argument `arg`.
-static lh_value yieldop(lh_optag optag, lh_value arg)
+// `yieldop_to` yields to a handler `h` that was found for operation `op`
+//   (`skipped` bytes down the handler stack) and passes it the argument `arg`.
+static lh_value yieldop_to(hstack* hs, effecthandler* h, const lh_operation* op, count skipped, lh_value arg)
 {
-  // find the operation handler along the handler stack
-  hstack*   hs = &__hstack;
-  count     skipped;
-  const lh_operation* op;
-  effecthandler* h = hstack_find(hs, optag, &op, &skipped);
-
   // No resume (i.e. like `throw`)
   if (op->opkind <= LH_OP_NORESUME) {
     #ifdef __cplusplus
@@ -1874,6 +4036,74 @@ static lh_value yieldop(lh_optag optag, lh_value arg)
   return lh_value_null;
 }
 
+// `yieldop_default` yields to a default handler `d`. Its operations are tail
+//   resumptive so we can call it directly. A default handler sits below the
+//   whole handler stack so, just like `yieldop_to`, we push a skip frame over all 
+//   handlers before calling an operation that may itself perform operations.
+static lh_value yieldop_default(hstack* hs, defaulthandler* d, const lh_operation* op, lh_value arg)
+{
+  tailresume r;
+  r.lhresume.rkind = TailResume;
+  r.local = d->local;
+  r.resumed = false;
+  lh_value res;
+  if (op->opkind != LH_OP_TAIL_NOOP && !hstack_empty(hs)) {
+    hstack_push_skip(hs, hs->count);  // skip down to and including the bottom frame
+    #ifdef __cplusplus
+    raii_hstack_pop do_pop(hs, false /* skip frames need no release */, LH_EFFECT(__skip));
+    #endif
+    res = op->opfun(&r.lhresume, d->local, arg);
+    #ifndef __cplusplus
+    assert(!hstack_empty(hs));
+    assert(is_skiphandler(hstack_top(hs)));
+    hstack_pop(hs, false); // skip frames need no release
+    #endif
+  }
+  else {
+    res = op->opfun(&r.lhresume, d->local, arg);
+  }
+  if (!r.resumed) {
+    fatal(EINVAL, "default handler operation did not resume: '%s'", lh_optag_name(op->optag));
+    return res;
+  }
+  // only write back if changed; usually the local state of a default is shared read-only between threads
+  if (r.local != d->local) {
+    d = defaults_find_effect(op->optag->effect);  // the operation may have (un)registered defaults
+    if (d != NULL) d->local = r.local;
+  }
+  return res;
+}
+
+// `yieldop_nohandler` is called if there is no handler on the handler stack for `optag`;
+//   it tries to yield to a default handler instead.
+static lh_value yieldop_nohandler(lh_optag optag, lh_value arg)
+{
+  const lh_operation* op;
+  defaulthandler* d = defaults_find(optag, &op);
+  if (d == NULL) {
+    fatal(ENOSYS, "no handler for operation found: '%s'", lh_optag_name(optag));
+    return lh_value_null;
+  }
+  return yieldop_default(&__hstack, d, op, arg);
+}
+
+// `yieldop` yields to the first enclosing handler that can handle
+//   operation `optag` and passes it the argument `arg`.
+static lh_value yieldop(lh_optag optag, lh_value arg)
+{
+  // find the operation handler along the handler stack
+  hstack*   hs = &__hstack;
+  count     skipped;
+  const lh_operation* op;
+  effecthandler* h = hstack_try_find(hs, optag, &op, &skipped);
+  if (h != NULL) {
+    return yieldop_to(hs, h, op, skipped, arg);
+  }
+  else {
+    return yieldop_nohandler(optag, arg);
+  }
+}
+
 // Yield to the first enclosing handler that can handle
 // operation `optag` and pass it the argument `arg`.
 lh_value lh_yield(lh_optag optag, lh_value arg) {
@@ -1883,6 +4113,97 @@ lh_value lh_yield(lh_optag optag, lh_value arg) {
   return yieldop(optag, arg);
 }
 
+/*-----------------------------------------------------------------
+  Optional operations
+-----------------------------------------------------------------*/
+
+// Is there an enclosing handler for operation `optag`?
+bool lh_has_handler(lh_optag optag) {
+  count     skipped;
+  const lh_operation* op;
+  return (hstack_try_find(&__hstack, optag, &op, &skipped) != NULL || defaults_find(optag, &op) != NULL);
+}
+
+// Yield to the first enclosing handler that can handle
+// operation `optag` if there is one; returns `false` if there was no handler.
+bool lh_try_yield(lh_optag optag, lh_value arg, lh_value* res) {
+  hstack*   hs = &__hstack;
+  count     skipped;
+  const lh_operation* op;
+  effecthandler* h = hstack_try_find(hs, optag, &op, &skipped);
+  defaulthandler* d = NULL;
+  if (h == NULL) {
+    d = defaults_find(optag, &op);
+    if (d == NULL) return false;
+  }
+  #ifdef _DEBUG_STATS
+  stats.operations++;
+  #endif
+  lh_value x = (h != NULL ? yieldop_to(hs, h, op, skipped, arg) : yieldop_default(hs, d, op, arg));
+  if (res != NULL) *res = x;
+  return true;
+}
+
+
+/*-----------------------------------------------------------------
+  Yield directly to a specific handler
+-----------------------------------------------------------------*/
+
+// Return a reference to the innermost handler for `effect`.
+lh_handlerref lh_find_handler(lh_effect effect) {
+  hstack* hs = &__hstack;
+  lh_handlerref href = { 0, 0 };
+  effecthandler* h = hstack_find_handler(hs, effect, 0);
+  if (h != NULL) {
+    href.id = h->id;
+    href.hint = ptrdiff(h, hs->hframes);  // offset from the bottom is stable while handlers are pushed on top
+  }
+  return href;
+}
+
+// Find the handler `href` refers to; first try the offset hint and otherwise search for it.
+static effecthandler* hstack_find_ref(hstack* hs, lh_effect effect, lh_handlerref href) {
+  if (href.id == 0) return NULL;  // not a valid reference
+  if (href.hint >= 0 && href.hint + (count)sizeof(effecthandler) <= hs->count) {
+    handler* h = (handler*)(hs->hframes + href.hint);
+    if (h->effect == effect && ((effecthandler*)h)->id == href.id) {
+      #ifndef NDEBUG
+      // validate the handler is still in scope, i.e. not skipped by an operation handler
+      if (hstack_find_handler(hs, effect, href.id) != (effecthandler*)h) {
+        fatal(EINVAL, "yield to a handler that is not in scope: '%s'", lh_effect_name(effect));
+      }
+      #endif
+      return (effecthandler*)h;
+    }
+  }
+  return hstack_find_handler(hs, effect, href.id);
+}
+
+// Yield operation `optag` directly to the handler `href` refers to.
+lh_value lh_yield_to(lh_handlerref href, lh_optag optag, lh_value arg) {
+  #ifdef _DEBUG_STATS
+  stats.operations++;
+  #endif
+  hstack*   hs = &__hstack;
+  effecthandler* h = hstack_find_ref(hs, optag->effect, href);
+  if (h == NULL) {
+    fatal(ENOSYS, "handler for operation is not in scope: '%s'", lh_optag_name(optag));
+    return lh_value_null;
+  }
+  const lh_operation* op = &h->hdef->operations[optag->opidx];
+  assert(op->optag == optag);
+  count skipped;
+  if (op->opfun != NULL) {
+    skipped = hstack_indexof(hs, to_handler(h));
+  }
+  else {
+    // forwarding operation: continue searching below the handler
+    h = hstack_try_find_from(hs, hstack_prev(hs, to_handler(h)), optag, &op, &skipped);
+    if (h == NULL) return yieldop_nohandler(optag, arg);
+  }
+  return yieldop_to(hs, h, op, skipped, arg);
+}
+
 
 /*-----------------------------------------------------------------
   Get the local state of a handler
@@ -1899,30 +4220,109 @@ lh_value lh_yield_local(lh_optag optag)
   hstack*   hs = &__hstack;
   count     skipped;
   const lh_operation* op;
-  effecthandler* h = hstack_find(hs, optag, &op, &skipped);
+  effecthandler* h = hstack_try_find(hs, optag, &op, &skipped);
   // and return the local state
-  return h->local;
+  if (h != NULL) return h->local;
+  // or that of a default handler
+  defaulthandler* d = defaults_find(optag, &op);
+  if (d == NULL) {
+    fatal(ENOSYS, "no handler for operation found: '%s'", lh_optag_name(optag));
+    return lh_value_null;
+  }
+  return d->local;
+}
+
+/*-----------------------------------------------------------------
+  Cached references to the local state of a handler
+-----------------------------------------------------------------*/
+
+// Point `lref` to the local state of the handler `h`, or that of a default handler if `h` is `NULL`.
+static void localref_set(lh_localref* lref, effecthandler* h) {
+  if (h != NULL) {
+    lref->id = h->id;
+    lref->slot = &h->local;
+    lref->epoch = __hstack_epoch;
+  }
+  else {
+    // a default handler is looked up on every access
+    lref->id = 0;
+    lref->slot = NULL;
+    lref->epoch = 0;
+  }
+}
+
+// Return a reference to the local state of the first enclosing handler for operation `optag`.
+lh_localref lh_find_local(lh_optag optag) {
+  hstack*   hs = &__hstack;
+  count     skipped;
+  const lh_operation* op;
+  lh_localref lref;
+  lref.optag = optag;
+  effecthandler* h = hstack_try_find(hs, optag, &op, &skipped);
+  if (h == NULL && defaults_find(optag, &op) == NULL) {
+    fatal(ENOSYS, "no handler for operation found: '%s'", lh_optag_name(optag));
+  }
+  localref_set(&lref, h);
+  return lref;
+}
+
+// Return the local state `lref` refers to; as long as no handlers moved this is just one load.
+lh_value lh_local_value(lh_localref* lref) {
+  if (lref->epoch == __hstack_epoch) {
+    #ifndef NDEBUG
+    // validate the handler is still live and in scope
+    hstack* hs = &__hstack;
+    effecthandler* h = (effecthandler*)((byte*)lref->slot - offsetof(effecthandler, local));
+    if ((byte*)h < hs->hframes || (byte*)h + sizeof(effecthandler) > hs->hframes + hs->count ||
+         hstack_find_handler(hs, lref->optag->effect, lref->id) != h) {
+      fatal(EINVAL, "local state reference to a handler that is not in scope: '%s'", lh_optag_name(lref->optag));
+    }
+    #endif
+    return *lref->slot;
+  }
+  // handlers moved (or it refers to a default handler): find the handler again
+  if (lref->id != 0) {
+    effecthandler* h = hstack_find_handler(&__hstack, lref->optag->effect, lref->id);
+    if (h == NULL) {
+      fatal(EINVAL, "local state reference to a handler that is not in scope: '%s'", lh_optag_name(lref->optag));
+      return lh_value_null;
+    }
+    localref_set(lref, h);
+    return h->local;
+  }
+  const lh_operation* op;
+  defaulthandler* d = defaults_find(lref->optag, &op);
+  if (d == NULL) {
+    fatal(ENOSYS, "no handler for operation found: '%s'", lh_optag_name(lref->optag));
+    return lh_value_null;
+  }
+  return d->local;
 }
 
 /*-----------------------------------------------------------------
   Passing multiple arguments
 -----------------------------------------------------------------*/
 
+// Is `p` in the (own) frames of a captured c-stack?
+static bool cstack_contains(const cstack* cs, const void* p) {
+  return (cs->frames != NULL && (const byte*)p >= cstack_base(cs) && (const byte*)p < cstack_base(cs) + cs->size);
+}
+
 // Get a pointer to values passed by stack reference in an operation handler
 void* lh_cstack_ptr(lh_resume r, void* p) {
   if (r->rkind == TailResume) return p;
   assert(r->rkind == GeneralResume || r->rkind == ScopedResume);
+  resume_thaw((resume*)r);
   cstack* cs = &((resume*)r)->cstack;
-  ptrdiff_t delta = ptrdiff(cs->frames, cs->base);
-  byte* q = (byte*)p + delta;
-  assert(q >= cs->frames && q < cs->frames + cs->size);
-  // paranoia: check that the new pointer is indeed in the captured stack
-  if (q >= cs->frames && q < cs->frames + cs->size) {
-    return q;
-  }
-  else {
+  // segments are shared with clones or other captures; copy them before handing out a writable pointer
+  if (!cstack_contains(cs, p)) cstack_unshare(cs);
+  if (!cstack_contains(cs, p)) {
+    // paranoia: the pointer is not in the captured stack
+    assert(false);
     return p;
   }
+  ptrdiff_t delta = ptrdiff(cs->frames, cs->base);
+  return (byte*)p + delta;
 }
 
 // Yield N arguments to an operation
@@ -1955,18 +4355,18 @@ static resume* to_resume(lh_resume r) {
   return (resume*)r;
 }
 
-static __noinline lh_value lh_release_resume_(resume* r, lh_value local, lh_value resarg) {
+static __noinline lh_value lh_release_resume_(resume* r, const lh_handlerdef* hdef, lh_value local, lh_value resarg) {
   hstack* hs = &__hstack;
   lh_value res;
   LH_INIT(hs)
-  res = capture_resume_call(&__hstack, r, local, resarg);
+  res = capture_resume_call(&__hstack, r, hdef, local, resarg);
   LH_DONE(hs)
   return res;
 }
 
 
 lh_value __noinline lh_call_resume(lh_resume r, lh_value local, lh_value res) {
-  return lh_release_resume_(resume_acquire(to_resume(r)), local, res);
+  return lh_release_resume_(resume_acquire(to_resume(r)), NULL, local, res);
 }
 
 lh_value lh_scoped_resume(lh_resume r, lh_value local, lh_value res) {
@@ -1978,10 +4378,17 @@ __noinline lh_value lh_release_resume(lh_resume r, lh_value local, lh_value res)
     return lh_scoped_resume(r, local, res);
   }
   else {
-    return lh_release_resume_(to_resume(r), local, res);
+    return lh_release_resume_(to_resume(r), NULL, local, res);
   }
 }
 
+// Resume a resumption of a shallow operation under a new handler `hdef`.
+__noinline lh_value lh_release_resume_with(lh_resume r, const lh_handlerdef* hdef, lh_value local, lh_value res) {
+  resume* rs = to_resume(r);
+  if (!rs->shallow) fatal(EINVAL, "Trying to resume a non-shallow resumption with a new handler");
+  return lh_release_resume_(rs, hdef, local, res);
+}
+
 lh_value lh_tail_resume(lh_resume r, lh_value local, lh_value res) {
   if (r->rkind == TailResume) {
     tailresume* tr = (tailresume*)(r);
@@ -2002,7 +4409,7 @@ static void _lh_release(resume* r) {
   if (r->refcount == 1 && r->resumptions == 0) {
     r->resumptions = -1; // so capture_resume_call will raise an exception
     try {
-      lh_release_resume_(r, lh_value_null, lh_value_null);
+      lh_release_resume_(r, NULL, lh_value_null, lh_value_null);
       assert(false); // we should never get here
     }
     catch (const lh_resume_unwind_exception& exn) {
@@ -2019,6 +4426,137 @@ void __noinline lh_release(lh_resume r) {
   if (r->rkind != TailResume) _lh_release(to_resume(r));
 }
 
+// Clone a first-class resumption: the clone can be resumed (or released) independently
+// of the original. The captured C stack is frozen into shared segments so both only
+// reference the same immutable frames; the captured handler stack is copied and the
+// local state of each handler is acquired (just like a capture that copies).
+lh_resume lh_resume_clone(lh_resume lhr) {
+  if (lhr->rkind != GeneralResume) fatal(EINVAL, "Only general resumptions can be cloned");
+  resume* r = to_resume(lhr);
+  if (r->refcount <= 0) fatal(EINVAL, "Trying to clone a released resumption");
+  resume_thaw(r);
+  resume* c = (resume*)object_malloc(LH_OBJ_RESUME, sizeof(resume));
+  memcpy(c, r, sizeof(resume));
+  resume_link_live(c);
+  c->refcount = 1;
+  c->resumptions = 0;
+  c->cold_prev = c->cold_next = NULL;
+  budget_acquire(c, r->budgeted);
+  // share the captured c-stack
+  cstack_freeze(&r->cstack);
+  assert(r->cstack.frames == NULL && r->cstack.size == 0);
+  c->cstack = r->cstack;
+  if (c->cstack.shared != NULL) csegment_acquire(c->cstack.shared);
+  // copy the captured handler stack
+  hstack_init(&c->hstack);
+  if (!hstack_empty(&r->hstack)) {
+    handler* h = hstack_append_copyfrom(&c->hstack, &r->hstack, hstack_bottom(&r->hstack));
+    handler_acquire(h);
+  }
+  // both can become cold again (the clone counts as a new capture)
+  resume_cold_link(r);
+  resume_cold_add(c);
+  #ifdef _STATS
+  stats.rcont_captured_resume++;
+  #endif
+  return to_lhresume(c);
+}
+
+// Return the reference count of a resumption.
+ptrdiff_t lh_resume_refcount(lh_resume r) {
+  if (r->rkind == TailResume) return 1;
+  return to_resume(r)->refcount;
+}
+
+// Enumerate the live resumptions of this thread.
+ptrdiff_t lh_enum_resumptions(lh_enumfun* fun, void* arg) {
+  ptrdiff_t n = 0;
+  resume* r;
+  for (r = __resumes_live; r != NULL; r = r->live_next) {
+    lh_resume_info info;
+    info.resume = to_lhresume(r);
+    info.refcount = r->refcount;
+    info.cstack_size = r->cstack.size;
+    info.cstack_shared = 0;
+    const csegment* seg;
+    for (seg = r->cstack.shared; seg != NULL; seg = seg->cstack.shared) {
+      info.cstack_shared += seg->cstack.size;
+    }
+    info.hstack_size = r->hstack.count;
+    info.compressed = (r->compressed != NULL);
+    info.spilled = (r->spilled != 0);
+    n++;
+    if (!fun(&info, arg)) break;
+  }
+  return n;
+}
+
+/*-----------------------------------------------------------------
+  Roots for garbage collectors
+-----------------------------------------------------------------*/
+
+static __thread count __roots_epoch = 0;
+
+// Enumerate the segments of a captured c-stack that were not visited yet. The frames of a 
+// deduplicated segment are part of its owner segment, which is enumerated (once) instead.
+static void csegment_enum_roots(csegment* seg, lh_rootfun* fun, void* arg) {
+  for (; seg != NULL && seg->marked != __roots_epoch; seg = seg->cstack.shared) {
+    seg->marked = __roots_epoch;
+    if (seg->owner != NULL) {
+      csegment_enum_roots(seg->owner, fun, arg);  // an owner has no owner itself
+    }
+    else if (seg->cstack.size > 0) {
+      fun(LH_ROOT_CSTACK, seg->cstack.frames, (size_t)seg->cstack.size, arg);
+    }
+  }
+}
+
+// Enumerate the frames of a captured c-stack and the segments below it that were not visited yet.
+static void cstack_enum_roots(const cstack* cs, lh_rootfun* fun, void* arg) {
+  if (cs->frames != NULL && cs->size > 0) fun(LH_ROOT_CSTACK, cs->frames, (size_t)cs->size, arg);
+  csegment_enum_roots(cs->shared, fun, arg);
+}
+
+// Enumerate the local state of the effect handlers in a handler stack.
+static void hstack_enum_roots(hstack* hs, lh_rootfun* fun, void* arg) {
+  if (hstack_empty(hs)) return;
+  handler* h = hstack_top(hs);
+  do {
+    if (is_effecthandler(h)) fun(LH_ROOT_LOCAL, &((effecthandler*)h)->local, sizeof(lh_value), arg);
+    h = hstack_prev(hs, h);
+  } while (h != NULL);
+}
+
+// Enumerate the roots of this thread that are held by libhandler.
+void lh_enum_roots(lh_rootfun* fun, void* arg) {
+  __roots_epoch++;
+  hstack_enum_roots(&__hstack, fun, arg);
+  byte* scan = NULL;     // the frames of a cold resumption are scanned in a copy so it stays cold
+  count scansize = 0;
+  resume* r;
+  for (r = __resumes_live; r != NULL; r = r->live_next) {
+    if (r->compressed != NULL || r->spilled != 0) {
+      if (r->cstack.size > scansize) {
+        scansize = r->cstack.size;
+        scan = (byte*)checked_realloc(scan, (size_t)scansize);
+      }
+      if (r->spilled != 0) resume_spilled_copy(r, scan);
+                      else decompress_frames(r->compressed, scan, r->cstack.size);
+      if (r->cstack.size > 0) fun(LH_ROOT_CSTACK, scan, (size_t)r->cstack.size, arg);
+      csegment_enum_roots(r->cstack.shared, fun, arg);
+    }
+    else {
+      cstack_enum_roots(&r->cstack, fun, arg);
+    }
+    hstack_enum_roots(&r->hstack, fun, arg);
+  }
+  if (scan != NULL) checked_free(scan);
+  fragment* f;
+  for (f = __fragments_live; f != NULL; f = f->live_next) {
+    cstack_enum_roots(&f->cstack, fun, arg);
+  }
+}
+
 void lh_nothing() { }
 
 // Convert function pointers to lh_values's; 
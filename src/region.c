@@ -0,0 +1,143 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016-2018, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+#include "libhandler.h"
+#include "cenv.h"     // configure generated
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+/*-----------------------------------------------------------------
+  Regions: memory is bump allocated from a list of chunks and
+  all chunks are freed at once when the region is released.
+
+  The region is the local state of a linear handler. Every copy
+  of the handler frame (when a continuation that includes the
+  scope is captured or resumed more than once) acquires the region,
+  so the region stays alive as long as it is referenced.
+-----------------------------------------------------------------*/
+
+#define REGION_ALIGN      (16)
+#define REGION_MINCHUNK   (4*1024)
+#define REGION_MAXCHUNK   (1024*1024)
+
+typedef struct _region_chunk {
+  struct _region_chunk* next;
+  size_t                size;     // usable size after the header
+} region_chunk;
+
+// keep the memory after the chunk header aligned
+#define REGION_CHUNK_HEADER  ((sizeof(region_chunk) + REGION_ALIGN - 1) & ~((size_t)REGION_ALIGN - 1))
+
+struct _lh_region {
+  ptrdiff_t     refcount;    // number of handler frames that refer to this region
+  region_chunk* chunks;      // the current chunk is the first one
+  uint8_t*      top;         // next free byte in the current chunk
+  uint8_t*      end;         // end of the current chunk
+  size_t        chunksize;   // size of the next chunk
+  size_t        allocated;   // total bytes allocated in the region
+};
+
+// Effect and operation for regions (defined as macros in libhandler.h)
+LH_DEFINE_EFFECT1(lh_region, alloc)
+
+static lh_value _region_alloc(lh_resume r, lh_value local, lh_value arg) {
+  (void)(arg);
+  return lh_tail_resume(r, local, local);
+}
+
+static const lh_operation _region_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(lh_region,alloc), &_region_alloc },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+
+static lh_value _region_acquire(lh_value local) {
+  lh_region* region = (lh_region*)lh_ptr_value(local);
+  region->refcount++;
+  return local;
+}
+
+static void _region_release(lh_value local) {
+  lh_region* region = (lh_region*)lh_ptr_value(local);
+  assert(region->refcount > 0);
+  if (--region->refcount > 0) return;
+  region_chunk* chunk = region->chunks;
+  while (chunk != NULL) {
+    region_chunk* next = chunk->next;
+    lh_free(chunk);
+    chunk = next;
+  }
+  lh_free(region);
+}
+
+const lh_handlerdef _lh_region_hdef = { LH_EFFECT(lh_region), &_region_acquire, &_region_release, NULL, _region_ops };
+
+lh_value _lh_region_create(size_t size) {
+  lh_region* region = (lh_region*)lh_malloc(sizeof(lh_region));
+  if (region == NULL) lh_throw_errno(ENOMEM);
+  memset(region, 0, sizeof(lh_region));
+  region->refcount = 1;
+  region->chunksize = (size < REGION_MINCHUNK ? REGION_MINCHUNK : size);
+  return lh_value_any_ptr(region);
+}
+
+lh_region* lh_region_current(void) {
+  return (lh_region*)lh_ptr_value(lh_yield_local(LH_OPTAG(lh_region,alloc)));
+}
+
+// Add a chunk that can hold at least `size` bytes
+static void region_grow(lh_region* region, size_t size) {
+  size_t chunksize = region->chunksize;
+  if (chunksize < size) chunksize = size;
+  if (chunksize > SIZE_MAX - REGION_CHUNK_HEADER) lh_throw_errno(ENOMEM);  // the first chunk size is given by the user
+  region_chunk* chunk = (region_chunk*)lh_malloc(REGION_CHUNK_HEADER + chunksize);
+  if (chunk == NULL) lh_throw_errno(ENOMEM);
+  chunk->size = chunksize;
+  chunk->next = region->chunks;
+  region->chunks = chunk;
+  region->top = (uint8_t*)chunk + REGION_CHUNK_HEADER;
+  region->end = region->top + chunksize;
+  // chunks grow exponentially up to a limit
+  if (region->chunksize < REGION_MAXCHUNK) region->chunksize *= 2;
+}
+
+void* lh_region_alloc_in(lh_region* region, size_t size) {
+  assert(region != NULL && region->refcount > 0);
+  // rounding up and adding a chunk header should not overflow
+  if (size > SIZE_MAX - REGION_ALIGN - REGION_CHUNK_HEADER) lh_throw_errno(ENOMEM);
+  size = (size + REGION_ALIGN - 1) & ~((size_t)REGION_ALIGN - 1);
+  if (size == 0) size = REGION_ALIGN;
+  if ((size_t)(region->end - region->top) < size) region_grow(region, size);
+  void* p = region->top;
+  region->top += size;
+  region->allocated += size;
+  return p;
+}
+
+void* lh_region_alloc(size_t size) {
+  return lh_region_alloc_in(lh_region_current(), size);
+}
+
+void* lh_region_calloc(size_t n, size_t size) {
+  if (size > 0 && n > SIZE_MAX / size) lh_throw_errno(ENOMEM);
+  void* p = lh_region_alloc(n * size);
+  memset(p, 0, n * size);
+  return p;
+}
+
+char* lh_region_strdup(const char* s) {
+  if (s == NULL) return NULL;
+  size_t n = strlen(s);
+  char* t = (char*)lh_region_alloc(n + 1);
+  memcpy(t, s, n + 1);
+  return t;
+}
+
+size_t lh_region_allocated(const lh_region* region) {
+  return region->allocated;
+}
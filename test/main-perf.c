@@ -14,6 +14,15 @@ int main(void)
 {
   printf("benchmark: " LH_CCNAME ", " LH_TARGET "\n");
   perf_counter();  
+  perf_multi();
+  perf_generator();
+  perf_implicit();
+  perf_amb();
+  perf_park();
+  perf_dedup();
+  perf_copy();
+  perf_deep();
+  perf_arena();
 
   lh_print_stats(stderr);
   tests_check_memory();
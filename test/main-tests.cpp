@@ -30,6 +30,25 @@ int main(void) {
     test_tailops();
     test_state_alloc();
     test_yieldn();
+    test_tryyield();
+    test_default();
+    test_yieldto();
+    test_multi();
+    test_shallow();
+    test_localref();
+    test_cell();
+    test_clone();
+    test_compress();
+    test_spill();
+    test_dedup();
+    test_budget();
+    test_arena();
+    test_trim();
+    test_alloc();
+    test_region();
+    test_embed();
+    test_roots();
+    test_summary();
 
     // c++ specific tests with destructors, finalizers etc.  test_destructor();
     test_destructor();
@@ -0,0 +1,74 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+
+static const int N = 50;   // searches
+static const int K = 12;   // choices per search
+
+/*-----------------------------------------------------------------
+  A backtracking search over all choices that counts the solutions;
+  the choices are made on top of a deep stack.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(choose, flip)
+LH_DEFINE_OP0(choose, flip, bool)
+
+static lh_value _choose_flip(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  int x = lh_int_value(lh_call_resume(r, local, lh_value_bool(true)));
+  int y = lh_int_value(lh_release_resume(r, local, lh_value_bool(false)));
+  return lh_value_int(x + y);
+}
+
+static const lh_operation _choose_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(choose,flip), &_choose_flip },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef choose_def = { LH_EFFECT(choose), NULL, NULL, NULL, _choose_ops };
+
+static int __noinline search_at(int depth, int k) {
+  volatile char frame[256];   // make each frame sizable
+  frame[0] = 0;
+  if (depth > 0) return search_at(depth - 1, k) + frame[0];
+  int parity = 0;
+  int i;
+  for (i = 0; i < k; i++) {
+    if (choose_flip()) parity ^= 1;
+  }
+  return (parity == 0 ? 1 : 0);
+}
+
+static lh_value search(lh_value arg) {
+  return lh_value_int(search_at(32, lh_int_value(arg)));
+}
+
+static lh_value loop_search(lh_value arg) {
+  int n = lh_int_value(arg);
+  int sum = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    sum += lh_int_value(lh_handle(&choose_def, lh_value_null, search, lh_value_int(K)));
+  }
+  return lh_value_int(sum);
+}
+
+void perf_amb() {
+  lh_stats st0, st1;
+  lh_get_stats(&st0);
+  double t0 = start_clock();
+  int sum = lh_int_value(state_handle(loop_search, 0, lh_value_int(N)));
+  double t = end_clock(t0);
+  lh_get_stats(&st1);
+  long captured = st1.captured - st0.captured;
+  if (captured <= 0) captured = 1;
+  printf("\nbacktracking: n=%i, %i choices\n", N, K);
+  printf("search:  %6fs, %i\n", t, sum);
+  printf("per capture: c-stack %li bytes, copied %li, shared %li\n",
+    (long)((st1.captured_cstack - st0.captured_cstack) / captured),
+    (long)((st1.captured_copied - st0.captured_copied) / captured),
+    (long)((st1.captured_shared - st0.captured_shared) / captured));
+}
@@ -0,0 +1,90 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+#include <string.h>
+#include <stdlib.h>
+
+/*-----------------------------------------------------------------
+  Latency of yielding to a handler that suspends the continuation,
+  with and without a reserved (pre-faulted) arena.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(susp, wait)
+LH_DEFINE_OP1(susp, wait, int, int)
+
+static const int N = 20000;
+static lh_resume* parked;
+static double*    latency;
+static double     t_yield;
+
+static lh_value _susp_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  int i = lh_int_value(arg);
+  latency[i] = end_clock(t_yield);
+  parked[i] = r;
+  return lh_value_int(0);
+}
+
+static const lh_operation _susp_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(susp,wait), &_susp_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef susp_def = { LH_EFFECT(susp), NULL, NULL, NULL, _susp_ops };
+
+// use 16KB of stack before suspending
+static int __noinline request_frames(int depth, int id) {
+  volatile char frame[4096];
+  memset((void*)frame, 0, sizeof(frame));
+  frame[id & 4095] = 1;
+  int x;
+  if (depth > 0) {
+    x = request_frames(depth - 1, id);
+  }
+  else {
+    t_yield = start_clock();
+    x = susp_wait(id);
+  }
+  return x + frame[id & 4095];
+}
+
+static lh_value request(lh_value arg) {
+  return lh_value_int(request_frames(3, lh_int_value(arg)));
+}
+
+static int compare_double(const void* p, const void* q) {
+  double x = *((const double*)p);
+  double y = *((const double*)q);
+  return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+static void run(const char* name, size_t arena) {
+  int i;
+  if (arena > 0) lh_reserve_arena(arena);
+  double t0 = start_clock();
+  for (i = 0; i < N; i++) {
+    lh_handle(&susp_def, lh_value_null, request, lh_value_int(i));
+  }
+  double tpark = end_clock(t0);
+  long sum = 0;
+  for (i = 0; i < N; i++) {
+    sum += lh_int_value(lh_release_resume(parked[i], lh_value_null, lh_value_int(1)));
+  }
+  if (arena > 0) lh_reserve_arena(0);
+  qsort(latency, (size_t)N, sizeof(double), &compare_double);
+  printf("%-6s: total %6fs, yield latency p50 %6.2fus, p99 %6.2fus, max %6.2fus (%li)\n", name, tpark,
+    1.0e6 * latency[N / 2], 1.0e6 * latency[(N * 99) / 100], 1.0e6 * latency[N - 1], sum);
+}
+
+void perf_arena() {
+  parked = (lh_resume*)malloc(N * sizeof(lh_resume));
+  latency = (double*)malloc(N * sizeof(double));
+  printf("\narena: %i suspended continuations of 16kb\n", N);
+  run("malloc", 0);
+  run("arena", 512 * 1024 * 1024);
+  free(latency);
+  free(parked);
+}
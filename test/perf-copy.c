@@ -0,0 +1,102 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+#include <string.h>
+#include <stdlib.h>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#else
+#include <alloca.h>
+#endif
+
+/*-----------------------------------------------------------------
+  Capture and restore throughput of C stacks from 256 bytes 
+  to 1MB, with and without the dedicated copy kernels.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(park, wait)
+LH_DEFINE_OP1(park, wait, int, int)
+
+static lh_resume* parked;
+
+static lh_value _park_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  parked[lh_int_value(arg)] = r;
+  return lh_value_int(0);
+}
+
+static const lh_operation _park_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(park,wait), &_park_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef park_def = { LH_EFFECT(park), NULL, NULL, NULL, _park_ops };
+
+static size_t frame_size;
+
+// use `frame_size` bytes of stack before parking
+static lh_value request(lh_value arg) {
+  volatile char* frame = (volatile char*)alloca(frame_size);
+  frame[0] = 1;
+  frame[frame_size - 1] = 1;
+  return lh_value_int(park_wait(lh_int_value(arg)) + frame[0]);
+}
+
+static void __noinline park_all(int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    lh_handle(&park_def, lh_value_null, request, lh_value_int(i));
+  }
+}
+
+static long __noinline resume_all(int n) {
+  long sum = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    sum += lh_int_value(lh_release_resume(parked[i], lh_value_null, lh_value_int(1)));
+  }
+  return sum;
+}
+
+// returns the capture and restore throughput in GB/s
+static void run(size_t size, int n, double* capture, double* restore) {
+  lh_stats st0, st1;
+  frame_size = size;
+  lh_get_stats(&st0);
+  double t0 = start_clock();
+  park_all(n);
+  double tpark = end_clock(t0);
+  lh_get_stats(&st1);
+  double bytes = (double)(st1.captured_cstack - st0.captured_cstack);
+  t0 = start_clock();
+  long sum = resume_all(n);
+  double tresume = end_clock(t0);
+  if (sum != 2 * (long)n) printf("copy: wrong result %li\n", sum);
+  double gb = 1024.0*1024.0*1024.0;
+  *capture = bytes / gb / (tpark > 0 ? tpark : 1e-9);
+  *restore = bytes / gb / (tresume > 0 ? tresume : 1e-9);
+}
+
+void perf_copy() {
+  size_t total = 256 * 1024 * 1024;
+  size_t size;
+  parked = (lh_resume*)malloc((total / 256) * sizeof(lh_resume));
+  const char* kernel = lh_set_copy_kernels(true);
+  printf("\ncopy: kernel %s, GB/s captured and restored\n", kernel);
+  printf("%8s  %8s %8s  %8s %8s\n", "size", "capture", "restore", "memcpy", "memcpy");
+  for (size = 256; size <= 1024 * 1024; size *= 4) {
+    int n = (int)(total / size / 4);
+    if (n > 100000) n = 100000;
+    double c1, r1, c0, r0;
+    lh_set_copy_kernels(true);
+    run(size, n, &c1, &r1);
+    lh_set_copy_kernels(false);
+    run(size, n, &c0, &r0);
+    printf("%8li  %8.2f %8.2f  %8.2f %8.2f\n", (long)size, c1, r1, c0, r0);
+  }
+  lh_set_copy_kernels(true);
+  free(parked);
+}
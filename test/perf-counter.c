@@ -47,6 +47,19 @@ static int counter() {
   return sum;
 }
 
+cell_define(count)
+
+static int counter_cell() {
+  lh_value* c = cell_ptr(count);
+  int i;
+  int sum = 0;
+  while ((i = lh_int_value(*c)) > 0) {
+    sum += work(i);
+    *c = lh_value_int(i - 1);
+  }
+  return sum;
+}
+
 static lh_value _counter(lh_value arg) {
   unreferenced(arg);
   return lh_value_int(counter());
@@ -60,6 +73,13 @@ static lh_value _counter_nowork(lh_value arg) {
 static int counter_eff(int n) {
   return lh_int_value(state_handle(_counter, n, lh_value_null));
 }
+static int counter_eff_cell(int n) {
+  int sum = 0;
+  {using_cell(lh_value_int(n), count) {
+    sum = counter_cell();
+  }}
+  return sum;
+}
 static int counter_eff_nowork(int n) {
   return lh_int_value(state_handle(_counter_nowork, n, lh_value_null));
 }
@@ -83,11 +103,16 @@ void perf_counter() {
   double t2 = end_clock(t0);
 
 
+  t0 = start_clock();
+  int sum4 = counter_eff_cell(n);
+  double t4 = end_clock(t0);
+
   double opsec = (double)(2 * n) / t2;
   printf("native:  %6fs, %i\n", t1, sum1);
   printf("effects: %6fs, %i  (no work)\n", t2, sum2);
   printf("effects: %6fs, %i\n", t3, sum3);
-  printf("summary: n=%i, %.3fx slower, %.3fx slower (work)\n", n, t2 / t1, t3 / t1);
+  printf("cell:    %6fs, %i\n", t4, sum4);
+  printf("summary: n=%i, %.3fx slower, %.3fx slower (work), %.3fx slower (cell)\n", n, t2 / t1, t3 / t1, t4 / t1);
   printf("       : %.3fx sqrt, %.3f million ops/sec\n", ((t3 / t1) - 1.0) / 2.0, opsec/1e6);
 }
 
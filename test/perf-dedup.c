@@ -0,0 +1,92 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const int N = 10000;
+
+/*-----------------------------------------------------------------
+  Identical tasks that are dispatched through an event loop and
+  park on the same await site; only the top of their stacks differ.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(aw, wait)
+LH_DEFINE_OP1(aw, wait, int, int)
+
+static lh_resume* parked;
+static int next_id;
+
+static lh_value _aw_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  parked[lh_int_value(arg)] = r;
+  return lh_value_int(0);
+}
+
+static const lh_operation _aw_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(aw,wait), &_aw_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef aw_def = { LH_EFFECT(aw), NULL, NULL, NULL, _aw_ops };
+
+static int __noinline task(void) {
+  volatile int id = next_id++;
+  return aw_wait(id) + 1;
+}
+
+// dispatcher frames: the same for every task (and larger than the dedup chunks)
+static int __noinline dispatch(int depth) {
+  void* volatile slots[512];
+  memset((void*)slots, 0, sizeof(slots));
+  slots[0] = (void*)&parked;
+  slots[1] = (void*)&slots[depth];
+  if (depth > 0) return dispatch(depth - 1) + (slots[0] != NULL ? 1 : 0);
+  return task();
+}
+
+static lh_value request(lh_value arg) {
+  unreferenced(arg);
+  return lh_value_int(dispatch(2));
+}
+
+static double run(bool dedup, int n, long* sum, ptrdiff_t* cstack, ptrdiff_t* deduped) {
+  lh_stats st0, st1;
+  lh_set_dedup(dedup);
+  next_id = 0;
+  lh_get_stats(&st0);
+  double t0 = start_clock();
+  int i;
+  for (i = 0; i < n; i++) {
+    lh_handle(&aw_def, lh_value_null, request, lh_value_null);
+  }
+  lh_get_stats(&st1);
+  *cstack = st1.captured_cstack - st0.captured_cstack;
+  *deduped = st1.captured_deduped - st0.captured_deduped;
+  *sum = 0;
+  for (i = 0; i < n; i++) {
+    *sum += lh_int_value(lh_release_resume(parked[i], lh_value_null, lh_value_int(1)));
+  }
+  double t = end_clock(t0);
+  lh_set_dedup(false);
+  return t;
+}
+
+void perf_dedup() {
+  int n = N;
+  long sum1, sum2;
+  ptrdiff_t cstack1, cstack2, deduped1, deduped2;
+  parked = (lh_resume*)malloc(n * sizeof(lh_resume));
+  double t1 = run(false, n, &sum1, &cstack1, &deduped1);
+  double t2 = run(true, n, &sum2, &cstack2, &deduped2);
+  free(parked);
+
+  printf("\ndedup: n=%i identical parked tasks\n", n);
+  printf("plain:  %6fs, %li, c-stack frames %li bytes per task\n", t1, sum1, (long)((cstack1 - deduped1) / n));
+  printf("dedup:  %6fs, %li, c-stack frames %li bytes per task (%li shared)\n", t2, sum2, (long)((cstack2 - deduped2) / n), (long)(deduped2 / n));
+  printf("summary: %.1fx less c-stack frame memory per task, %.3fx slower\n", 
+    (double)(cstack1 - deduped1) / (double)(cstack2 - deduped2 > 0 ? cstack2 - deduped2 : 1), t2 / t1);
+}
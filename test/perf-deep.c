@@ -0,0 +1,90 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+#include <string.h>
+
+/*-----------------------------------------------------------------
+  Resume continuations with deep (100KB+) captured stacks from
+  a shallow stack; the restore must get out of the way of the
+  restored stack first.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(deep, wait)
+LH_DEFINE_OP1(deep, wait, int, int)
+
+#define PARKED (64)
+static lh_resume parked[PARKED];
+
+static lh_value _deep_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  parked[lh_int_value(arg)] = r;
+  return lh_value_int(0);
+}
+
+static const lh_operation _deep_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(deep,wait), &_deep_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef deep_def = { LH_EFFECT(deep), NULL, NULL, NULL, _deep_ops };
+
+// recurse with 1KB frames
+static int __noinline recurse(int depth, int id) {
+  volatile char frame[1024];
+  memset((void*)frame, 0, sizeof(frame));
+  frame[depth & 1023] = (char)id;
+  int x = (depth > 0 ? recurse(depth - 1, id) : deep_wait(id));
+  return x + frame[depth & 1023];
+}
+
+static int depth;
+
+static lh_value request(lh_value arg) {
+  return lh_value_int(recurse(depth, lh_int_value(arg)));
+}
+
+static void __noinline park_all(void) {
+  int i;
+  for (i = 0; i < PARKED; i++) {
+    lh_handle(&deep_def, lh_value_null, request, lh_value_int(i));
+  }
+}
+
+static long __noinline resume_all(void) {
+  long sum = 0;
+  int i;
+  for (i = 0; i < PARKED; i++) {
+    sum += lh_int_value(lh_release_resume(parked[i], lh_value_null, lh_value_int(1)));
+  }
+  return sum;
+}
+
+void perf_deep() {
+  int kb;
+  printf("\ndeep: resume %i continuations from a shallow stack\n", PARKED);
+  for (kb = 128; kb <= 1024; kb *= 2) {
+    lh_stats st0, st1;
+    int n = 10;
+    int i;
+    double tpark = 0, tresume = 0;
+    long sum = 0;
+    depth = kb;
+    lh_get_stats(&st0);
+    for (i = 0; i < n; i++) {
+      double t0 = start_clock();
+      park_all();
+      tpark += end_clock(t0);
+      t0 = start_clock();
+      sum += resume_all();
+      tresume += end_clock(t0);
+    }
+    lh_get_stats(&st1);
+    double size = (double)(st1.captured_cstack - st0.captured_cstack) / (double)(n * PARKED);
+    printf("%5.0fkb: park %6.2fus, resume %6.2fus per continuation, %.2f GB/s restored (%li)\n",
+      size / 1024.0, 1.0e6 * tpark / (n * PARKED), 1.0e6 * tresume / (n * PARKED),
+      size * (n * PARKED) / (1024.0*1024.0*1024.0) / (tresume > 0 ? tresume : 1e-9), sum);
+  }
+}
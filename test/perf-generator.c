@@ -0,0 +1,110 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+
+static const int N = 1000000;
+
+/*-----------------------------------------------------------------
+  Step through a generator with a deep or shallow handler
+  (the generators are defined in `test-shallow.c`)
+-----------------------------------------------------------------*/
+
+static lh_value loop_deep(lh_value arg) {
+  return lh_value_int(gen_sum_deep(lh_int_value(arg)));
+}
+
+static lh_value loop_shallow(lh_value arg) {
+  return lh_value_int(gen_sum_shallow(lh_int_value(arg)));
+}
+
+/*-----------------------------------------------------------------
+  A generator that yields from deep in the stack
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(dgen, yield)
+LH_DEFINE_VOIDOP1(dgen, yield, int)
+
+static int __noinline produce_at(int depth, int n) {
+  volatile char frame[256];   // make each frame sizable
+  frame[0] = (char)depth;
+  if (depth > 0) return produce_at(depth - 1, n) + frame[0];
+  int i;
+  for (i = 0; i < n; i++) {
+    dgen_yield(i);
+  }
+  return 0;
+}
+
+static lh_value produce_deep(lh_value arg) {
+  return lh_value_int(produce_at(32, lh_int_value(arg)));
+}
+
+typedef struct _dgen_step {
+  int       value;
+  lh_resume resume;
+} dgen_step;
+
+static lh_value _dgen_yield(lh_resume r, lh_value local, lh_value arg) {
+  dgen_step* st = (dgen_step*)lh_ptr_value(local);
+  st->value = lh_int_value(arg);
+  st->resume = r;
+  return lh_value_null;
+}
+
+static lh_value _dgen_result(lh_value local, lh_value arg) {
+  dgen_step* st = (dgen_step*)lh_ptr_value(local);
+  st->resume = NULL;
+  return arg;
+}
+
+static const lh_operation _dgen_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(dgen,yield), &_dgen_yield },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef dgen_def = { LH_EFFECT(dgen), NULL, NULL, &_dgen_result, _dgen_ops };
+
+static lh_value loop_deep_stack(lh_value arg) {
+  dgen_step st = { 0, NULL };
+  lh_handle(&dgen_def, lh_value_any_ptr(&st), produce_deep, arg);
+  int sum = 0;
+  while (st.resume != NULL) {
+    sum += st.value;
+    lh_release_resume(st.resume, lh_value_any_ptr(&st), lh_value_null);
+  }
+  return lh_value_int(sum);
+}
+
+static double run(lh_actionfun* loop, int n, int* sum, long* size, long* copied) {
+  lh_stats st0, st1;
+  lh_get_stats(&st0);
+  double t0 = start_clock();
+  *sum = lh_int_value(state_handle(loop, 0, lh_value_int(n)));
+  double t = end_clock(t0);
+  lh_get_stats(&st1);
+  *size = (long)((st1.captured_cstack - st0.captured_cstack) / n);
+  *copied = (long)((st1.captured_copied - st0.captured_copied) / n);
+  return t;
+}
+
+void perf_generator() {
+  int n = N;
+  int sum1, sum2;
+  long size1, size2, copied1, copied2;
+
+  // run under an outer handler so the handler stack is not allocated for each step
+  double t1 = run(loop_deep, n, &sum1, &size1, &copied1);
+  double t2 = run(loop_shallow, n, &sum2, &size2, &copied2);
+  int sum3;
+  long size3, copied3;
+  double t3 = run(loop_deep_stack, n, &sum3, &size3, &copied3);
+
+  printf("\ngenerator: n=%i\n", n);
+  printf("deep   :  %6fs, %i, c-stack %li bytes per step, copied %li\n", t1, sum1, size1, copied1);
+  printf("shallow:  %6fs, %i, c-stack %li bytes per step, copied %li\n", t2, sum2, size2, copied2);
+  printf("summary: %.3fx faster\n", t1 / t2);
+  printf("deep stack: %6fs, %i, c-stack %li bytes per step, copied %li\n", t3, sum3, size3, copied3);
+}
@@ -0,0 +1,65 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+
+static const int N = 10000000;
+
+implicit_define(config)
+
+/*-----------------------------------------------------------------
+  Read an implicit parameter that is bound below a few other handlers
+-----------------------------------------------------------------*/
+
+static lh_value __noinline loop_get(lh_value arg) {
+  int n = lh_int_value(arg);
+  long sum = 0;
+  int i;
+  for (i = 0; i < n; i++) sum += lh_long_value(implicit_get(config));
+  return lh_value_long(sum);
+}
+
+static lh_value __noinline loop_ref(lh_value arg) {
+  int n = lh_int_value(arg);
+  lh_localref cfg = implicit_ref(config);
+  long sum = 0;
+  int i;
+  for (i = 0; i < n; i++) sum += lh_long_value(implicit_get_ref(cfg));
+  return lh_value_long(sum);
+}
+
+static lh_actionfun* loop;
+
+static lh_value nest(lh_value arg) {
+  int depth = lh_int_value(arg);
+  if (depth > 0) return state_handle(nest, 0, lh_value_int(depth - 1));
+  return loop(lh_value_int(N));
+}
+
+static long run(lh_actionfun* action) {
+  lh_value res = lh_value_null;
+  loop = action;
+  {using_implicit(lh_value_long(1), config) {
+    res = nest(lh_value_int(8));
+  }}
+  return lh_long_value(res);
+}
+
+void perf_implicit() {
+  double t0 = start_clock();
+  long sum1 = run(loop_get);
+  double t1 = end_clock(t0);
+
+  t0 = start_clock();
+  long sum2 = run(loop_ref);
+  double t2 = end_clock(t0);
+
+  printf("\nimplicit parameters: n=%i, 8 handlers in between\n", N);
+  printf("get:     %6fs, %li\n", t1, sum1);
+  printf("ref:     %6fs, %li\n", t2, sum2);
+  printf("summary: %.3fx faster\n", t1 / t2);
+}
@@ -0,0 +1,89 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+
+static const int N = 1000000;
+
+/*-----------------------------------------------------------------
+  Five small reader handlers, installed nested or all at once
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(rd0, ask)
+LH_DEFINE_EFFECT1(rd1, ask)
+LH_DEFINE_EFFECT1(rd2, ask)
+LH_DEFINE_EFFECT1(rd3, ask)
+LH_DEFINE_EFFECT1(rd4, ask)
+
+static lh_value _rd_ask(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, local, local);
+}
+
+#define RD_DEF(name) \
+  static const lh_operation _##name##_ops[] = { { LH_OP_TAIL_NOOP, LH_OPTAG(name,ask), &_rd_ask }, { LH_OP_NULL, lh_op_null, NULL } }; \
+  static const lh_handlerdef name##_def = { LH_EFFECT(name), NULL, NULL, NULL, _##name##_ops };
+
+RD_DEF(rd0)
+RD_DEF(rd1)
+RD_DEF(rd2)
+RD_DEF(rd3)
+RD_DEF(rd4)
+
+static lh_value body(lh_value arg) {
+  return lh_value_int(lh_int_value(arg) +
+                      lh_int_value(lh_yield(LH_OPTAG(rd0, ask), lh_value_null)) +
+                      lh_int_value(lh_yield(LH_OPTAG(rd4, ask), lh_value_null)));
+}
+
+static lh_value nested4(lh_value arg) { return lh_handle(&rd4_def, lh_value_int(4), body, arg); }
+static lh_value nested3(lh_value arg) { return lh_handle(&rd3_def, lh_value_int(3), nested4, arg); }
+static lh_value nested2(lh_value arg) { return lh_handle(&rd2_def, lh_value_int(2), nested3, arg); }
+static lh_value nested1(lh_value arg) { return lh_handle(&rd1_def, lh_value_int(1), nested2, arg); }
+
+static int __noinline nested(int i) {
+  return lh_int_value(lh_handle(&rd0_def, lh_value_int(0), nested1, lh_value_int(i)));
+}
+
+static int __noinline multi(int i) {
+  static const lh_handlerdef* defs[5] = { &rd0_def, &rd1_def, &rd2_def, &rd3_def, &rd4_def };
+  static const lh_value locals[5] = { 0, 1, 2, 3, 4 };
+  return lh_int_value(lh_handle_multi(defs, locals, 5, body, lh_value_int(i)));
+}
+
+static lh_value loop_nested(lh_value arg) {
+  int n = lh_int_value(arg);
+  int sum = 0;
+  int i;
+  for (i = 0; i < n; i++) sum += nested(i & 0xFF);
+  return lh_value_int(sum);
+}
+
+static lh_value loop_multi(lh_value arg) {
+  int n = lh_int_value(arg);
+  int sum = 0;
+  int i;
+  for (i = 0; i < n; i++) sum += multi(i & 0xFF);
+  return lh_value_int(sum);
+}
+
+void perf_multi() {
+  int n = N;
+
+  // run under an outer handler so the handler stack is not allocated for each iteration
+  double t0 = start_clock();
+  int sum1 = lh_int_value(state_handle(loop_nested, 0, lh_value_int(n)));
+  double t1 = end_clock(t0);
+
+  t0 = start_clock();
+  int sum2 = lh_int_value(state_handle(loop_multi, 0, lh_value_int(n)));
+  double t2 = end_clock(t0);
+
+  printf("\nmulti handlers: n=%i, 5 handlers\n", n);
+  printf("nested:  %6fs, %i\n", t1, sum1);
+  printf("multi :  %6fs, %i\n", t2, sum2);
+  printf("summary: %.3fx faster\n", t1 / t2);
+}
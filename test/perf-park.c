@@ -0,0 +1,117 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "perf.h"
+#include <string.h>
+#include <stdlib.h>
+
+static const int N = 1000000;
+
+/*-----------------------------------------------------------------
+  Requests that park on an I/O wait; the handler keeps the
+  continuation around until all requests are parked.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(io, wait)
+LH_DEFINE_OP1(io, wait, int, int)
+
+static lh_resume* parked;
+
+static lh_value _io_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  parked[lh_int_value(arg)] = r;
+  return lh_value_int(0);
+}
+
+static const lh_operation _io_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(io,wait), &_io_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef io_def = { LH_EFFECT(io), NULL, NULL, NULL, _io_ops };
+
+// a few frames with local state: mostly zeros, some pointers and small integers
+static int __noinline serve(int depth, int id) {
+  void* volatile slots[16];
+  memset((void*)slots, 0, sizeof(slots));
+  slots[0] = (void*)&parked;
+  slots[1] = (void*)&slots[depth];
+  slots[2 + (id & 7)] = (void*)(intptr_t)id;
+  if (depth > 0) return serve(depth - 1, id) + (slots[0] != NULL ? 1 : 0);
+  return io_wait(id) + (int)(intptr_t)slots[2 + (id & 7)];
+}
+
+static lh_value request(lh_value arg) {
+  return lh_value_int(serve(4, lh_int_value(arg)));
+}
+
+static void __noinline park_all(int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    lh_handle(&io_def, lh_value_null, request, lh_value_int(i));
+  }
+}
+
+static long __noinline resume_all(int n) {
+  long sum = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    sum += lh_int_value(lh_release_resume(parked[i], lh_value_null, lh_value_int(1)));
+  }
+  return sum;
+}
+
+typedef struct _park_result {
+  double    tpark;
+  double    tresume;
+  long      sum;
+  ptrdiff_t cstack;
+  ptrdiff_t saved;
+  long      compressed;
+  ptrdiff_t spilled;
+} park_result;
+
+static void run(long threshold, size_t budget, int n, park_result* res) {
+  lh_stats st0, st1;
+  lh_set_compress_threshold(threshold);
+  if (budget > 0) {
+    const char* dir = getenv("TMPDIR");
+    lh_set_spill_store(dir != NULL ? dir : "/tmp", budget);
+  }
+  lh_get_stats(&st0);
+  double t0 = start_clock();
+  park_all(n);
+  res->tpark = end_clock(t0);
+  lh_get_stats(&st1);
+  res->cstack = st1.captured_cstack - st0.captured_cstack;
+  res->saved = st1.compressed_saved - st0.compressed_saved;
+  res->compressed = st1.compressed - st0.compressed;
+  res->spilled = st1.spilled_size - st0.spilled_size;
+  t0 = start_clock();
+  res->sum = resume_all(n);
+  res->tresume = end_clock(t0);
+  lh_set_compress_threshold(0);
+  lh_set_spill_store(NULL, 0);
+}
+
+void perf_park() {
+  int n = N;
+  park_result plain, comp, spill;
+  parked = (lh_resume*)malloc(n * sizeof(lh_resume));
+  run(0, 0, n, &plain);
+  run(64, 0, n, &comp);
+  run(0, 64*1024*1024, n, &spill);
+  free(parked);
+
+  double mb = 1024.0*1024.0;
+  printf("\npark: n=%i, c-stack %li bytes per continuation\n", n, (long)(plain.cstack / n));
+  printf("plain     : park %6fs, resume %6fs, %li, c-stack %.1fmb\n", plain.tpark, plain.tresume, plain.sum, (double)plain.cstack / mb);
+  printf("compressed: park %6fs, resume %6fs, %li, c-stack %.1fmb (%li compressed)\n", comp.tpark, comp.tresume, comp.sum, (double)(comp.cstack - comp.saved) / mb, comp.compressed);
+  printf("spilled   : park %6fs, resume %6fs, %li, c-stack %.1fmb (%.1fmb spilled)\n", spill.tpark, spill.tresume, spill.sum, (double)(spill.cstack - spill.spilled) / mb, (double)spill.spilled / mb);
+  printf("summary: compression saved %.1f%% memory, %.0fns added per resume\n",
+    100.0 * (double)comp.saved / (double)(comp.cstack > 0 ? comp.cstack : 1), 1.0e9 * (comp.tresume - plain.tresume) / n);
+  printf("summary: spilling moved %.1f%% out of memory, %.0fns added per resume\n",
+    100.0 * (double)spill.spilled / (double)(spill.cstack > 0 ? spill.cstack : 1), 1.0e9 * (spill.tresume - plain.tresume) / n);
+}
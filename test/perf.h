@@ -27,5 +27,14 @@ double end_clock(double start);
   Performance tests
 -----------------------------------------------------------------*/
 void perf_counter();
+void perf_multi();
+void perf_generator();
+void perf_implicit();
+void perf_amb();
+void perf_park();
+void perf_dedup();
+void perf_copy();
+void perf_deep();
+void perf_arena();
 
 #endif
@@ -0,0 +1,148 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+#include <stdlib.h>
+#include <errno.h>
+
+/*-----------------------------------------------------------------
+  Requests that run a few tasks; the tasks park and are resumed
+  before the request ends so their resumptions can be allocated
+  in the memory of the request.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(step, wait)
+LH_DEFINE_OP1(step, wait, int, int)
+
+#define TASKS (4)
+static lh_resume parked[TASKS];
+static int count;
+
+static char  request_mem[64*1024];
+static bool  in_request_mem;
+
+static bool is_request_mem(const void* p) {
+  return ((const char*)p >= request_mem && (const char*)p < request_mem + sizeof(request_mem));
+}
+
+static lh_value _step_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  if (!is_request_mem(r)) in_request_mem = false;
+  parked[count++] = r;
+  return arg;
+}
+
+static const lh_operation _step_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(step,wait), &_step_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef step_def = { LH_EFFECT(step), NULL, NULL, NULL, _step_ops };
+
+static lh_value task(lh_value arg) {
+  return lh_value_int(step_wait(lh_int_value(arg)) + 1);
+}
+
+static lh_value request(lh_value arg) {
+  int i;
+  count = 0;
+  for (i = 0; i < TASKS; i++) {
+    lh_handle(&step_def, lh_value_null, task, lh_value_int(i));
+  }
+  long sum = 0;
+  for (i = 0; i < count; i++) {
+    sum += lh_int_value(lh_release_resume(parked[i], lh_value_null, lh_value_int(i)));
+  }
+  if (lh_int_value(arg) != 0) lh_throw_str(EINVAL, "request failed");
+  return lh_value_long(sum);
+}
+
+static long handle_request(int fail) {
+  return lh_long_value(lh_handle_arena(request_mem, sizeof(request_mem), &step_def, lh_value_null, request, lh_value_int(fail)));
+}
+
+static lh_value failing_request(lh_value arg) {
+  return lh_value_long(handle_request(lh_int_value(arg)));
+}
+
+// a request that leaves a task parked
+static lh_value leaky_request(lh_value arg) {
+  count = 0;
+  lh_handle(&step_def, lh_value_null, task, arg);
+  return lh_value_long(count);
+}
+
+static lh_value handle_leaky_request(lh_value arg) {
+  return lh_handle_arena(request_mem, sizeof(request_mem), &step_def, lh_value_null, leaky_request, arg);
+}
+
+// count allocations of this thread
+static long allocs;
+
+static void* counting_malloc(size_t size) {
+  allocs++;
+  return malloc(size);
+}
+static void* counting_calloc(size_t n, size_t size) {
+  allocs++;
+  return calloc(n, size);
+}
+static void* counting_realloc(void* p, size_t size) {
+  if (p == NULL) allocs++;
+  return realloc(p, size);
+}
+static void counting_free(void* p) {
+  allocs--;
+  free(p);
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static void run() {
+  // allocate the resumptions of each request in its memory
+  in_request_mem = true;
+  long sum = handle_request(0);
+  sum += handle_request(0);
+  test_printf("sum: %li, in request memory: %s\n", sum, in_request_mem ? "true" : "false");
+
+  // the memory scope ends on an exception too
+  lh_exception* exn = NULL;
+  lh_try(&exn, failing_request, lh_value_int(1));
+  test_printf("exception: %s\n", exn != NULL ? exn->msg : "none");
+  if (exn != NULL) lh_exception_free(exn);
+  count = 0;
+  lh_handle(&step_def, lh_value_null, task, lh_value_int(0));
+  test_printf("outside request memory: %s\n", count == 1 && !is_request_mem(parked[0]) ? "true" : "false");
+  lh_release(parked[0]);
+
+  // resumptions that are still alive at the end of the scope are left to the program
+  lh_try(&exn, handle_leaky_request, lh_value_int(1));
+  test_printf("leaked: %s, parked: %i\n", exn != NULL && exn->code == EFAULT ? "true" : "false", count);
+  if (exn != NULL) lh_exception_free(exn);
+  int x = lh_int_value(lh_release_resume(parked[0], lh_value_null, lh_value_int(10)));
+  test_printf("released after the scope: %i, sum: %li\n", x, handle_request(0));
+
+  // thread local allocation functions
+  allocs = 0;
+  lh_register_thread_malloc(&counting_malloc, &counting_calloc, &counting_realloc, &counting_free);
+  char* s = lh_strdup("request");
+  long n = allocs;
+  lh_free(s);
+  lh_register_thread_malloc(NULL, NULL, NULL, NULL);
+  test_printf("thread allocations: %li, live: %li\n", n, allocs);
+}
+
+void test_alloc() {
+  test("allocation scopes", run,
+    "sum: 20, in request memory: true\n"
+    "exception: request failed\n"
+    "outside request memory: true\n"
+    "leaked: true, parked: 1\n"
+    "released after the scope: 11, sum: 10\n"
+    "thread allocations: 1, live: 0\n"
+  );
+}
@@ -0,0 +1,71 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+/*-----------------------------------------------------------------
+  Park continuations while captured stacks are allocated in
+  a reserved arena.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(worker, sleep)
+LH_DEFINE_OP1(worker, sleep, int, int)
+
+#define PARKED (100)
+static lh_resume parked[PARKED];
+
+static lh_value _worker_sleep(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  parked[lh_int_value(arg)] = r;
+  return lh_value_int(-1);
+}
+
+static const lh_operation _worker_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(worker,sleep), &_worker_sleep },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef worker_def = { LH_EFFECT(worker), NULL, NULL, NULL, _worker_ops };
+
+static int sleeper(int depth, int id) {
+  volatile int frame[64];
+  int i;
+  for (i = 0; i < 64; i++) frame[i] = (i % 3 == 0 ? id * i : 0);
+  int x = (depth > 0 ? sleeper(depth - 1, id) : worker_sleep(id));
+  int sum = 0;
+  for (i = 0; i < 64; i++) sum += frame[i];
+  return x + sum;
+}
+
+static lh_value request(lh_value arg) {
+  return lh_value_int(sleeper(3, lh_int_value(arg)));
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static void run() {
+  // reserve an arena (rounded up to the huge page size)
+  bool reserved = lh_reserve_arena(64*1024);
+  int i;
+  for (i = 0; i < PARKED; i++) {
+    lh_handle(&worker_def, lh_value_null, request, lh_value_int(i));
+  }
+  // cannot release the arena while it is in use
+  bool released = (reserved && lh_reserve_arena(0));
+  long sum = 0;
+  for (i = 0; i < PARKED; i++) {
+    sum += lh_int_value(lh_release_resume(parked[i], lh_value_null, lh_value_int(i)));
+  }
+  test_printf("sum: %li, released while parked: %s\n", sum, released ? "true" : "false");
+  if (reserved) lh_reserve_arena(0);
+}
+
+void test_arena() {
+  test("arena for captured stacks", run,
+    "sum: 13726350, released while parked: false\n"
+  );
+}
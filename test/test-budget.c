@@ -0,0 +1,132 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+#include <errno.h>
+
+/*-----------------------------------------------------------------
+  Park tasks under a capture budget
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(park, wait)
+LH_DEFINE_OP1(park, wait, int, int)
+
+#define PARKED (10)
+static lh_resume parked[PARKED];
+static int first;  // first parked task that is not resumed yet
+static int count;  // number of parked tasks
+static int done;   // sum of results of the resumed tasks
+
+static lh_value _park_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  parked[count++] = r;
+  return arg;
+}
+
+static const lh_operation _park_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(park,wait), &_park_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef park_def = { LH_EFFECT(park), NULL, NULL, NULL, _park_ops };
+
+static lh_value task(lh_value arg) {
+  return lh_value_int(park_wait(lh_int_value(arg)) + 1);
+}
+
+static void park_task(int i) {
+  lh_handle(&park_def, lh_value_null, task, lh_value_int(i));
+}
+
+static lh_value park_all(lh_value arg) {
+  int i;
+  for (i = 0; i < lh_int_value(arg); i++) park_task(i);
+  return lh_value_null;
+}
+
+static void resume_all(void) {
+  while (first < count) {
+    done += lh_int_value(lh_release_resume(parked[first++], lh_value_null, lh_value_int(1)));
+  }
+}
+
+static ptrdiff_t live(void) {
+  lh_stats st;
+  lh_get_stats(&st);
+  return st.captured_live;
+}
+
+static void reset(void) {
+  first = count = done = 0;
+}
+
+// block: resume the oldest parked task to make room
+static bool make_room(ptrdiff_t needed, ptrdiff_t budget) {
+  unreferenced(needed);
+  unreferenced(budget);
+  if (first >= count) return false;
+  done += lh_int_value(lh_release_resume(parked[first++], lh_value_null, lh_value_int(1)));
+  return true;
+}
+
+static int notified;
+static bool notify(ptrdiff_t needed, ptrdiff_t budget) {
+  test_printf("notify: %s\n", needed > budget ? "true" : "false");
+  notified++;
+  return true;
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static void run() {
+  ptrdiff_t live0 = live();
+  reset();
+  park_all(lh_value_int(1));
+  ptrdiff_t size = live() - live0;
+  resume_all();
+  test_printf("live after resume: %s\n", live() == live0 ? "true" : "false");
+
+  // throw when over budget
+  reset();
+  lh_set_capture_budget(live0 + 4*size + size/2, LH_BUDGET_THROW, NULL);
+  lh_exception* exn = NULL;
+  lh_try(&exn, park_all, lh_value_int(PARKED));
+  test_printf("parked: %i, exception: %s\n", count, (exn != NULL && exn->code == ENOMEM ? "ENOMEM" : "none"));
+  if (exn != NULL) lh_exception_free(exn);
+  resume_all();
+  test_printf("resumed: %i, live: %s\n", done, live() == live0 ? "true" : "false");
+
+  // block until enough tasks are resumed
+  reset();
+  lh_set_capture_budget(live0 + 2*size + size/2, LH_BUDGET_BLOCK, &make_room);
+  park_all(lh_value_int(PARKED));
+  test_printf("parked: %i, resumed while blocked: %i\n", count, first);
+  resume_all();
+  test_printf("resumed: %i, live: %s\n", done, live() == live0 ? "true" : "false");
+
+  // just call back
+  reset();
+  notified = 0;
+  lh_set_capture_budget(live0 + 1*size + size/2, LH_BUDGET_CALLBACK, &notify);
+  park_all(lh_value_int(3));
+  resume_all();
+  test_printf("parked: %i, notified: %i\n", count, notified);
+  lh_set_capture_budget(0, LH_BUDGET_THROW, NULL);
+}
+
+void test_budget() {
+  test("capture budget", run,
+    "live after resume: true\n"
+    "parked: 4, exception: ENOMEM\n"
+    "resumed: 8, live: true\n"
+    "parked: 10, resumed while blocked: 8\n"
+    "resumed: 20, live: true\n"
+    "notify: true\n"
+    "notify: true\n"
+    "parked: 3, notified: 2\n"
+  );
+}
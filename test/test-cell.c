@@ -0,0 +1,93 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+cell_define(counter)
+
+/*-----------------------------------------------------------------
+  Count down with direct access to the cell
+-----------------------------------------------------------------*/
+
+static int count_down() {
+  lh_value* n = cell_ptr(counter);
+  int sum = 0;
+  while (lh_int_value(*n) > 0) {
+    sum += lh_int_value(*n);
+    *n = lh_value_int(lh_int_value(*n) - 1);
+  }
+  return sum;
+}
+
+/*-----------------------------------------------------------------
+  The `foo` example of test-amb.c with a cell instead of the state effect;
+  the cell pointer is obtained before any continuation is captured.
+-----------------------------------------------------------------*/
+
+static bool cell_xor() {
+  bool p = amb_flip();
+  bool q = amb_flip();
+  return ((p || q) && (!(p && q)));
+}
+
+static lh_value cell_foo(lh_value arg) {
+  unreferenced(arg);
+  lh_value* n = cell_ptr(counter);
+  bool p = amb_flip();
+  int i = lh_int_value(*n);
+  *n = lh_value_int(i + 1);
+  return lh_value_bool(i > 0 && p ? cell_xor() : false);
+}
+
+static lh_value amb_cell_foo(lh_value arg) {
+  lh_value res = lh_value_null;
+  {using_cell(lh_value_int(0), counter) {
+    res = cell_foo(arg);
+  }}
+  return res;
+}
+
+static lh_value cell_amb_foo(lh_value arg) {
+  lh_value res = lh_value_null;
+  {using_cell(lh_value_int(0), counter) {
+    res = amb_handle(cell_foo, arg);
+    test_printf("final counter: %i\n", lh_int_value(cell_get(counter)));
+  }}
+  return res;
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static void run() {
+  {using_cell(lh_value_int(10), counter) {
+    test_printf("count down: %i\n", count_down());
+    test_printf("counter: %i\n", lh_int_value(cell_get(counter)));
+    {using_cell(lh_value_int(3), counter) {
+      test_printf("inner count down: %i\n", count_down());
+    }}
+    cell_put(counter, lh_value_int(2));
+    test_printf("counter op: %i\n", lh_int_value(lh_yield(LH_OPTAG(counter, cell), lh_value_null)));
+  }}
+  blist res1 = lh_blist_value(cell_amb_foo(lh_value_null));
+  blist_print("final result cell/amb foo", res1); printf("\n");
+  blist res2 = lh_blist_value(amb_handle(amb_cell_foo, lh_value_null));
+  blist_print("final result amb/cell foo", res2); printf("\n");
+}
+
+void test_cell() {
+  test("state cells", run,
+    "count down: 55\n"
+    "counter: 0\n"
+    "inner count down: 6\n"
+    "counter op: 2\n"
+    "final counter: 2\n"
+    "final result cell/amb foo: [false,false,true,true,false]\n"
+    "final result amb/cell foo: [false,false]\n"
+  );
+}
@@ -0,0 +1,137 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+/*-----------------------------------------------------------------
+  A fork effect where the handler does a breadth-first search
+  by cloning the continuation and queueing both branches.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(fork, split)
+LH_DEFINE_OP0(fork, split, bool)
+
+typedef struct _branch {
+  lh_resume resume;
+  bool      choice;
+} branch;
+
+static branch queue[64];
+static int    qhead;
+static int    qtail;
+
+static void enqueue(lh_resume r, bool choice) {
+  queue[qtail].resume = r;
+  queue[qtail].choice = choice;
+  qtail++;
+}
+
+// count the live local states
+static int live;
+
+static lh_value _fork_acquire(lh_value local) {
+  live++;
+  return local;
+}
+
+static void _fork_release(lh_value local) {
+  unreferenced(local);
+  live--;
+}
+
+static lh_value _fork_split(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  lh_resume c = lh_resume_clone(r);
+  if (lh_int_value(local) == 0) {
+    test_printf("refcount: %li, clone: %li\n", (long)lh_resume_refcount(r), (long)lh_resume_refcount(c));
+    // a clone can also be released without resuming it
+    lh_release(lh_resume_clone(c));
+  }
+  enqueue(c, true);
+  enqueue(r, false);
+  return lh_value_int(-1);
+}
+
+static lh_value _fork_result(lh_value local, lh_value arg) {
+  unreferenced(local);
+  if (lh_int_value(arg) >= 0) test_printf("leaf: %i\n", lh_int_value(arg));
+  return arg;
+}
+
+static const lh_operation _fork_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(fork,split), &_fork_split },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef fork_def = { LH_EFFECT(fork), &_fork_acquire, &_fork_release, &_fork_result, _fork_ops };
+
+/*-----------------------------------------------------------------
+  Writing through a stack reference into a cloned continuation
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(poke, set)
+
+static lh_value _poke_set(lh_resume r, lh_value local, lh_value arg) {
+  lh_resume c = lh_resume_clone(r);
+  int* p = (int*)lh_cstack_ptr_value(r, arg);
+  *p = 10;  // only visible to `r`
+  int y = lh_int_value(lh_release_resume(c, local, lh_value_null));
+  int x = lh_int_value(lh_release_resume(r, local, lh_value_null));
+  test_printf("poked: %i, clone: %i\n", x, y);
+  return lh_value_int(x + y);
+}
+
+static const lh_operation _poke_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(poke,set), &_poke_set },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef poke_def = { LH_EFFECT(poke), NULL, NULL, NULL, _poke_ops };
+
+static lh_value poke(lh_value arg) {
+  volatile int x = lh_int_value(arg);  // passed by stack reference
+  lh_yield(LH_OPTAG(poke,set), lh_value_cstack_ptr((void*)&x));
+  return lh_value_int(x);
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static lh_value search(lh_value arg) {
+  int n = lh_int_value(arg);
+  int x = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    x = 2*x + (fork_split() ? 1 : 0);
+  }
+  return lh_value_int(x);
+}
+
+static void run() {
+  qhead = qtail = 0;
+  live = 1;  // the initial local
+  lh_handle(&fork_def, lh_value_int(0), search, lh_value_int(3));
+  while (qhead < qtail) {
+    branch* b = &queue[qhead++];
+    lh_release_resume(b->resume, lh_value_int(1), lh_value_bool(b->choice));
+  }
+  test_printf("live locals: %i\n", live);
+  lh_handle(&poke_def, lh_value_null, poke, lh_value_int(1));
+}
+
+void test_clone() {
+  test("clone resumptions", run,
+    "refcount: 1, clone: 1\n"
+    "leaf: 7\n"
+    "leaf: 6\n"
+    "leaf: 5\n"
+    "leaf: 4\n"
+    "leaf: 3\n"
+    "leaf: 2\n"
+    "leaf: 1\n"
+    "leaf: 0\n"
+    "live locals: 0\n"
+    "poked: 10, clone: 1\n"
+  );
+}
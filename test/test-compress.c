@@ -0,0 +1,110 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+/*-----------------------------------------------------------------
+  Park continuations that wait on a value; cold continuations
+  are compressed and decompressed again when resumed.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(await, wait)
+LH_DEFINE_OP1(await, wait, int, int)
+
+#define PARKED (100)
+#define NEWER  (8)
+static lh_resume parked[PARKED + NEWER];
+
+static lh_value _await_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  parked[lh_int_value(arg)] = r;
+  return lh_value_int(-1);
+}
+
+static const lh_operation _await_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(await,wait), &_await_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef await_def = { LH_EFFECT(await), NULL, NULL, NULL, _await_ops };
+
+// use some stack with local state that must survive compression
+static int waiter(int depth, int id) {
+  volatile int frame[64];
+  int i;
+  for (i = 0; i < 64; i++) frame[i] = (i % 3 == 0 ? id * i : 0);
+  int x = (depth > 0 ? waiter(depth - 1, id) : await_wait(id));
+  int sum = 0;
+  for (i = 0; i < 64; i++) sum += frame[i];
+  return x + sum;
+}
+
+static lh_value request(lh_value arg) {
+  return lh_value_int(waiter(3, lh_int_value(arg)));
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+typedef struct _cold_query {
+  lh_resume r;
+  bool      cold;
+} cold_query;
+
+static bool find_cold(const lh_resume_info* info, void* arg) {
+  cold_query* q = (cold_query*)arg;
+  if (info->resume != q->r) return true;
+  q->cold = info->compressed;
+  return false;
+}
+
+static bool is_cold(lh_resume r) {
+  cold_query q = { r, false };
+  lh_enum_resumptions(&find_cold, &q);
+  return q.cold;
+}
+
+static long resume_all(void) {
+  long sum = 0;
+  int i;
+  for (i = 0; i < PARKED; i++) {
+    sum += lh_int_value(lh_release_resume(parked[i], lh_value_null, lh_value_int(i)));
+  }
+  return sum;
+}
+
+static void run() {
+  lh_stats st0, st1;
+  lh_get_stats(&st0);
+  lh_set_compress_threshold(8);
+  int i;
+  for (i = 0; i < PARKED; i++) {
+    lh_handle(&await_def, lh_value_null, request, lh_value_int(i));
+  }
+  // cloning a compressed continuation works too
+  lh_resume c = lh_resume_clone(parked[0]);
+  // and both become cold again after enough newer captures
+  for (i = PARKED; i < PARKED + NEWER; i++) {
+    lh_handle(&await_def, lh_value_null, request, lh_value_int(i));
+  }
+  bool cold = is_cold(parked[0]) && is_cold(c);
+  for (i = PARKED; i < PARKED + NEWER; i++) {
+    lh_release(parked[i]);
+  }
+  long sum = resume_all();
+  int x = lh_int_value(lh_release_resume(c, lh_value_null, lh_value_int(1)));
+  lh_set_compress_threshold(0);
+  lh_get_stats(&st1);
+  test_printf("sum: %li, clone: %i, cold again: %s\n", sum, x, cold ? "true" : "false");
+  test_printf("compressed: %s\n", st1.compressed - st0.compressed >= PARKED - 8 ? "true" : "false");
+}
+
+void test_compress() {
+  test("compress cold resumptions", run,
+    "sum: 13726350, clone: 1, cold again: true\n"
+    "compressed: true\n"
+  );
+}
@@ -0,0 +1,86 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+/*-----------------------------------------------------------------
+  Park identical tasks that only differ at the top of their stack;
+  the bottom of their captured stacks is shared.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(task, wait)
+LH_DEFINE_OP1(task, wait, int, int)
+
+#define PARKED (100)
+static lh_resume parked[PARKED];
+static int next_id;
+
+static lh_value _task_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  parked[lh_int_value(arg)] = r;
+  return lh_value_int(-1);
+}
+
+static const lh_operation _task_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(task,wait), &_task_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef task_def = { LH_EFFECT(task), NULL, NULL, NULL, _task_ops };
+
+// the task state is only at the top of the stack
+static int task(void) {
+  volatile int id = next_id++;
+  return id + task_wait(id);
+}
+
+// a dispatcher with the same frames for each task
+static int dispatch(int depth) {
+  volatile int frame[1024];
+  int i;
+  for (i = 0; i < 1024; i++) frame[i] = (i % 3 == 0 ? depth * i : 0);
+  int x = (depth > 0 ? dispatch(depth - 1) : task());
+  int sum = 0;
+  for (i = 0; i < 1024; i++) sum += frame[i];
+  return x + sum;
+}
+
+static lh_value request(lh_value arg) {
+  unreferenced(arg);
+  return lh_value_int(dispatch(3));
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static void run() {
+  lh_stats st0, st1;
+  lh_get_stats(&st0);
+  lh_set_dedup(true);
+  next_id = 0;
+  int i;
+  for (i = 0; i < PARKED; i++) {
+    lh_handle(&task_def, lh_value_null, request, lh_value_null);
+  }
+  lh_get_stats(&st1);
+  // a deduplicated continuation can be cloned and resumed more than once
+  lh_resume c = lh_resume_clone(parked[0]);
+  long sum = 0;
+  for (i = 0; i < PARKED; i++) {
+    sum += lh_int_value(lh_release_resume(parked[i], lh_value_null, lh_value_int(i)));
+  }
+  int x = lh_int_value(lh_release_resume(c, lh_value_null, lh_value_int(1)));
+  lh_set_dedup(false);
+  test_printf("sum: %li, clone: %i\n", sum, x);
+  test_printf("deduplicated: %s\n", st1.captured_deduped - st0.captured_deduped >= (PARKED - 1) * 4096 ? "true" : "false");
+}
+
+void test_dedup() {
+  test("dedup captured stacks", run,
+    "sum: 104969700, clone: 1049599\n"
+    "deduplicated: true\n"
+  );
+}
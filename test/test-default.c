@@ -0,0 +1,101 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+/*-----------------------------------------------------------------
+  A tracing effect that is handled by a default handler
+  that counts the messages in its local state.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(tracer, msg)
+implicit_define(verbosity)
+
+static void tracer_msg(const char* msg) {
+  lh_yield(LH_OPTAG(tracer, msg), lh_value_lh_string(msg));
+}
+
+static lh_value _tracer_default_msg(lh_resume r, lh_value local, lh_value arg) {
+  // tail operations can use other effects but, like the default handler itself, 
+  // they are outside of all handlers and only see the defaults
+  test_printf("default %li: %s, verbosity %i, state handler: %s\n", (long)lh_long_value(local), lh_lh_string_value(arg), 
+              lh_int_value(implicit_get(verbosity)), lh_has_handler(LH_OPTAG(state, get)) ? "true" : "false");
+  return lh_tail_resume(r, lh_value_long(lh_long_value(local) + 1), lh_value_null);
+}
+
+static const lh_operation _tracer_default_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(tracer,msg), &_tracer_default_msg },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef tracer_default_def = { LH_EFFECT(tracer), NULL, NULL, NULL, _tracer_default_ops };
+
+static lh_value _tracer_msg(lh_resume r, lh_value local, lh_value arg) {
+  test_printf("inner: %s\n", lh_lh_string_value(arg));
+  return lh_tail_resume(r, local, lh_value_null);
+}
+
+static const lh_operation _tracer_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(tracer,msg), &_tracer_msg },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef tracer_def = { LH_EFFECT(tracer), NULL, NULL, NULL, _tracer_ops };
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static lh_value count_traced(lh_value arg) {
+  unreferenced(arg);
+  int i;
+  while ((i = state_get()) > 0) {
+    tracer_msg("count");
+    state_put(i - 1);
+  }
+  return implicit_get(verbosity);
+}
+
+static lh_value state_count_traced(lh_value arg) {
+  return state_handle(count_traced, 2, arg);
+}
+
+static void run() {
+  test_printf("has tracer: %s\n", lh_has_handler(LH_OPTAG(tracer, msg)) ? "true" : "false");
+  lh_register_default_handler(&tracer_default_def, lh_value_long(1));
+  implicit_default(lh_value_int(1), verbosity);
+  test_printf("has tracer: %s\n", lh_has_handler(LH_OPTAG(tracer, msg)) ? "true" : "false");
+  lh_value res1 = state_count_traced(lh_value_null);
+  test_printf("test res1: %i\n", lh_int_value(res1));
+  lh_value res2 = lh_handle(&tracer_def, lh_value_null, state_count_traced, lh_value_null);
+  test_printf("test res2: %i\n", lh_int_value(res2));
+  {using_implicit(lh_value_int(2), verbosity) {
+    lh_value res3 = state_count_traced(lh_value_null);
+    test_printf("test res3: %i\n", lh_int_value(res3));
+  }}
+  test_printf("unregister: %s\n", lh_unregister_default_handler(LH_EFFECT(tracer)) ? "true" : "false");
+  test_printf("unregister: %s\n", lh_unregister_default_handler(LH_EFFECT(verbosity)) ? "true" : "false");
+  test_printf("unregister: %s\n", lh_unregister_default_handler(LH_EFFECT(tracer)) ? "true" : "false");
+  test_printf("has tracer: %s\n", lh_has_handler(LH_OPTAG(tracer, msg)) ? "true" : "false");
+}
+
+void test_default() {
+  test("default handlers", run,
+    "has tracer: false\n"
+    "has tracer: true\n"
+    "default 1: count, verbosity 1, state handler: false\n"
+    "default 2: count, verbosity 1, state handler: false\n"
+    "test res1: 1\n"
+    "inner: count\n"
+    "inner: count\n"
+    "test res2: 1\n"
+    "default 3: count, verbosity 1, state handler: false\n"
+    "default 4: count, verbosity 1, state handler: false\n"
+    "test res3: 2\n"
+    "unregister: true\n"
+    "unregister: true\n"
+    "unregister: false\n"
+    "has tracer: false\n"
+  );
+}
@@ -0,0 +1,122 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+#include <stdlib.h>
+
+/*-----------------------------------------------------------------
+  A host heap that accounts for the objects of each kind
+-----------------------------------------------------------------*/
+static long      host_live[LH_OBJ_KINDS];
+static ptrdiff_t host_bytes;
+
+static void* host_alloc(lh_objkind kind, size_t size, void* arg) {
+  unreferenced(arg);
+  size_t* p = (size_t*)malloc(size + 16);
+  if (p == NULL) return NULL;
+  *p = size;
+  host_live[kind]++;
+  host_bytes += (ptrdiff_t)size;
+  return (p + 2);
+}
+
+static void host_free(lh_objkind kind, void* p, void* arg) {
+  unreferenced(arg);
+  size_t* q = (size_t*)p - 2;
+  host_live[kind]--;
+  host_bytes -= (ptrdiff_t)(*q);
+  free(q);
+}
+
+static void host_register(bool on) {
+  int kind;
+  for (kind = 0; kind < LH_OBJ_KINDS; kind++) {
+    lh_register_object_alloc((lh_objkind)kind, (on ? &host_alloc : NULL), (on ? &host_free : NULL), NULL);
+  }
+}
+
+/*-----------------------------------------------------------------
+  Fibers of the host that suspend
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(vm, suspend)
+LH_DEFINE_OP1(vm, suspend, int, int)
+
+#define FIBERS (8)
+static lh_resume suspended[FIBERS];
+static int count;
+
+static lh_value _vm_suspend(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  suspended[count++] = r;
+  return arg;
+}
+
+static const lh_operation _vm_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(vm,suspend), &_vm_suspend },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef vm_def = { LH_EFFECT(vm), NULL, NULL, NULL, _vm_ops };
+
+static int fiber_run(int depth, int id) {
+  volatile int frame[32];
+  int i;
+  for (i = 0; i < 32; i++) frame[i] = id;
+  int x = (depth > 0 ? fiber_run(depth - 1, id) : vm_suspend(id));
+  return x + frame[id % 32];
+}
+
+static lh_value fiber(lh_value arg) {
+  return lh_value_int(fiber_run(2, lh_int_value(arg)));
+}
+
+typedef struct _census {
+  long      n;
+  ptrdiff_t cstack;
+  bool      counted;
+} census;
+
+static bool count_resume(const lh_resume_info* info, void* arg) {
+  census* c = (census*)arg;
+  c->n++;
+  c->cstack += info->cstack_size + info->cstack_shared;
+  if (info->refcount != lh_resume_refcount(info->resume)) c->counted = false;
+  return true;
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static void run() {
+  host_register(true);
+  count = 0;
+  int i;
+  for (i = 0; i < FIBERS; i++) {
+    lh_handle(&vm_def, lh_value_null, fiber, lh_value_int(i));
+  }
+  census c = { 0, 0, true };
+  ptrdiff_t n = lh_enum_resumptions(&count_resume, &c);
+  test_printf("live: %li, enumerated: %li, refcounts: %s\n", (long)n, c.n, c.counted ? "true" : "false");
+  test_printf("host resumptions: %li, host handler stacks: %li, host bytes cover the stacks: %s\n", 
+              host_live[LH_OBJ_RESUME], host_live[LH_OBJ_HSTACK], host_bytes >= c.cstack ? "true" : "false");
+  // objects are freed by the host even after unregistering
+  host_register(false);
+  long sum = 0;
+  for (i = 0; i < count; i++) {
+    sum += lh_int_value(lh_release_resume(suspended[i], lh_value_null, lh_value_int(i)));
+  }
+  n = lh_enum_resumptions(&count_resume, &c);
+  test_printf("sum: %li, live: %li, host objects: %li\n", sum, (long)n, host_live[LH_OBJ_RESUME] + host_live[LH_OBJ_FRAGMENT] + host_live[LH_OBJ_CSTACK] + host_live[LH_OBJ_HSTACK]);
+}
+
+void test_embed() {
+  test("host allocated continuations", run,
+    "live: 8, enumerated: 8, refcounts: true\n"
+    "host resumptions: 8, host handler stacks: 8, host bytes cover the stacks: true\n"
+    "sum: 112, live: 0, host objects: 0\n"
+  );
+}
@@ -0,0 +1,83 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+implicit_define(width)
+
+/*-----------------------------------------------------------------
+  An effect with a general operation that moves the handlers
+  above it when it resumes
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(suspend, op)
+LH_DEFINE_OP0(suspend, op, int)
+
+static lh_value _suspend_op(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_release_resume(r, local, lh_value_int(1));
+}
+
+static const lh_operation _suspend_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(suspend,op), &_suspend_op },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef suspend_def = { LH_EFFECT(suspend), NULL, NULL, NULL, _suspend_ops };
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static lh_localref width_ref;
+
+// push many handlers to force the handler stack to be reallocated
+static lh_value deep(lh_value arg) {
+  int n = lh_int_value(arg);
+  if (n > 0) return state_handle(deep, n, lh_value_int(n - 1));
+  return implicit_get_ref(width_ref);
+}
+
+static lh_value ref_action(lh_value arg) {
+  unreferenced(arg);
+  width_ref = implicit_ref(width);
+  test_printf("width: %i, ref: %i\n", lh_int_value(implicit_get(width)), lh_int_value(implicit_get_ref(width_ref)));
+  {using_implicit(lh_value_int(20), width) {
+    // the reference keeps referring to the outer binding
+    test_printf("width: %i, ref: %i\n", lh_int_value(implicit_get(width)), lh_int_value(implicit_get_ref(width_ref)));
+  }}
+  test_printf("deep ref: %i\n", lh_int_value(deep(lh_value_int(200))));
+  int x = suspend_op();
+  test_printf("resumed %i, ref: %i\n", x, lh_int_value(implicit_get_ref(width_ref)));
+  return implicit_get_ref(width_ref);
+}
+
+static lh_value suspend_action(lh_value arg) {
+  lh_value res = lh_value_null;
+  {using_implicit(lh_value_int(10), width) {
+    res = ref_action(arg);
+  }}
+  return res;
+}
+
+static void run() {
+  lh_value res = lh_handle(&suspend_def, lh_value_null, suspend_action, lh_value_null);
+  test_printf("test res: %i\n", lh_int_value(res));
+  implicit_default(lh_value_int(5), width);
+  lh_localref dref = implicit_ref(width);
+  test_printf("default ref: %i\n", lh_int_value(implicit_get_ref(dref)));
+  lh_unregister_default_handler(LH_EFFECT(width));
+}
+
+void test_localref() {
+  test("local references", run,
+    "width: 10, ref: 10\n"
+    "width: 20, ref: 10\n"
+    "deep ref: 10\n"
+    "resumed 1, ref: 10\n"
+    "test res: 10\n"
+    "default ref: 5\n"
+  );
+}
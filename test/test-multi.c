@@ -0,0 +1,121 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+/*-----------------------------------------------------------------
+  Define a reader, a counter, a choice, and an abort effect
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(env, ask)
+LH_DEFINE_EFFECT1(cnt, tick)
+LH_DEFINE_EFFECT1(choice, flip)
+LH_DEFINE_EFFECT1(abort, raise)
+
+LH_DEFINE_OP0(env, ask, int)
+LH_DEFINE_OP0(cnt, tick, int)
+LH_DEFINE_OP0(choice, flip, bool)
+LH_DEFINE_VOIDOP1(abort, raise, int)
+
+static lh_value _env_ask(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, local, local);
+}
+
+static lh_value _cnt_tick(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  lh_value i = lh_value_int(lh_int_value(local) + 1);
+  return lh_tail_resume(r, i, i);
+}
+
+static lh_value _cnt_result(lh_value local, lh_value arg) {
+  return lh_value_int(lh_int_value(arg) + 1000*lh_int_value(local));
+}
+
+static lh_value _choice_flip(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  int x = lh_int_value(lh_call_resume(r, local, lh_value_bool(true)));
+  int y = lh_int_value(lh_release_resume(r, local, lh_value_bool(false)));
+  return lh_value_int(x + y);
+}
+
+static lh_value _abort_raise(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(r);
+  unreferenced(local);
+  return arg;
+}
+
+static const lh_operation _env_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(env,ask), &_env_ask },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_operation _cnt_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(cnt,tick), &_cnt_tick },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_operation _choice_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(choice,flip), &_choice_flip },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_operation _abort_ops[] = {
+  { LH_OP_NORESUME, LH_OPTAG(abort,raise), &_abort_raise },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+
+static const lh_handlerdef env_def    = { LH_EFFECT(env), NULL, NULL, NULL, _env_ops };
+static const lh_handlerdef cnt_def    = { LH_EFFECT(cnt), NULL, NULL, &_cnt_result, _cnt_ops };
+static const lh_handlerdef choice_def = { LH_EFFECT(choice), NULL, NULL, NULL, _choice_ops };
+static const lh_handlerdef abort_def  = { LH_EFFECT(abort), NULL, NULL, NULL, _abort_ops };
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+// aborts immediately if `arg` is zero 
+// (note: we abort before `choice_flip` as in C++ we cannot unwind through a resumption that is resumed again)
+static lh_value body(lh_value arg) {
+  int x = env_ask();
+  if (lh_int_value(arg) == 0) abort_raise(99);
+  bool b = choice_flip();
+  int t = cnt_tick();
+  return lh_value_int(x + (b ? 10 : 20) + t);
+}
+
+static lh_value env_body(lh_value arg) {
+  return lh_handle(&env_def, lh_value_int(1), body, arg);
+}
+static lh_value choice_env_body(lh_value arg) {
+  return lh_handle(&choice_def, lh_value_null, env_body, arg);
+}
+static lh_value cnt_choice_env_body(lh_value arg) {
+  return lh_handle(&cnt_def, lh_value_int(0), choice_env_body, arg);
+}
+
+static lh_value nested(lh_value arg) {
+  return lh_handle(&abort_def, lh_value_null, cnt_choice_env_body, arg);
+}
+
+static lh_value multi(lh_value arg) {
+  const lh_handlerdef* defs[4] = { &abort_def, &cnt_def, &choice_def, &env_def };
+  const lh_value locals[4] = { lh_value_null, lh_value_int(0), lh_value_null, lh_value_int(1) };
+  return lh_handle_multi(defs, locals, 4, body, arg);
+}
+
+static void run() {
+  test_printf("nested: %i\n", lh_int_value(nested(lh_value_int(1))));
+  test_printf("multi : %i\n", lh_int_value(multi(lh_value_int(1))));
+  test_printf("nested abort: %i\n", lh_int_value(nested(lh_value_int(0))));
+  test_printf("multi  abort: %i\n", lh_int_value(multi(lh_value_int(0))));
+}
+
+void test_multi() {
+  test("multi handlers", run,
+    "nested: 2035\n"
+    "multi : 2035\n"
+    "nested abort: 99\n"
+    "multi  abort: 99\n"
+  );
+}
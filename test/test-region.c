@@ -0,0 +1,148 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*-----------------------------------------------------------------
+  Track the chunks of regions with a first chunk of CHUNK bytes
+-----------------------------------------------------------------*/
+#define CHUNK (100000)
+
+#define MAXCHUNKS (64)
+static void* chunks[MAXCHUNKS];  // live chunks
+
+static long live_chunks(void) {
+  long n = 0;
+  int i;
+  for (i = 0; i < MAXCHUNKS; i++) {
+    if (chunks[i] != NULL) n++;
+  }
+  return n;
+}
+
+static void track(void* old, void* p) {
+  int i;
+  for (i = 0; i < MAXCHUNKS; i++) {
+    if (chunks[i] == old) { chunks[i] = p; return; }
+  }
+}
+
+static void* tracking_malloc(size_t size) {
+  void* p = malloc(size);
+  if (p != NULL && size >= CHUNK && size <= CHUNK + 64) track(NULL, p);
+  return p;
+}
+static void tracking_free(void* p) {
+  track(p, NULL);
+  free(p);
+}
+static void* tracking_calloc(size_t n, size_t size) {
+  return calloc(n, size);
+}
+static void* tracking_realloc(void* p, size_t size) {
+  track(p, NULL);
+  return realloc(p, size);
+}
+
+/*-----------------------------------------------------------------
+  Pick a value twice, resuming the continuation two times
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(twice, pick)
+LH_DEFINE_OP0(twice, pick, int)
+
+static lh_value _twice_pick(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  int x = lh_int_value(lh_call_resume(r, local, lh_value_int(1)));
+  int y = lh_int_value(lh_release_resume(r, local, lh_value_int(2)));
+  return lh_value_int(x + y);
+}
+
+static const lh_operation _twice_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(twice,pick), &_twice_pick },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef twice_def = { LH_EFFECT(twice), NULL, NULL, NULL, _twice_ops };
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static int nested(void) {
+  int n = 0;
+  {using_region(CHUNK){
+    lh_region* outer = lh_region_current();
+    char* s = lh_region_strdup("outer");
+    {using_region(CHUNK){
+      int i;
+      for (i = 0; i < 1000; i++) lh_region_alloc(100);
+      n = (lh_region_current() != outer ? 1 : 0) + (lh_region_allocated(lh_region_current()) >= 100000 ? 1 : 0)
+        + (live_chunks() == 2 ? 1 : 0);
+    }}
+    n += (lh_region_current() == outer && strcmp(s, "outer") == 0 ? 1 : 0);
+  }}
+  return n;
+}
+
+static lh_value throwing(lh_value arg) {
+  {using_region(CHUNK){
+    lh_region_calloc(10, 10);
+    lh_throw_str(EINVAL, "region aborted");
+  }}
+  return arg;
+}
+
+static lh_value huge(lh_value arg) {
+  {using_region(CHUNK){
+    lh_region_alloc(SIZE_MAX - 8);
+  }}
+  return arg;
+}
+
+// the allocation before the pick is shared by both resumptions
+static lh_value picking(lh_value arg) {
+  int x = 0;
+  {using_region(CHUNK){
+    int* shared = (int*)lh_region_alloc(sizeof(int));
+    *shared = 10;
+    int y = twice_pick();
+    int* own = (int*)lh_region_alloc(sizeof(int));
+    *own = y;
+    x = *shared + *own;
+  }}
+  return lh_value_int(x + lh_int_value(arg));
+}
+
+static void run() {
+  lh_register_thread_malloc(&tracking_malloc, &tracking_calloc, &tracking_realloc, &tracking_free);
+  int n = nested();
+  test_printf("nested: %i, live chunks: %li\n", n, live_chunks());
+
+  lh_exception* exn = NULL;
+  lh_try(&exn, throwing, lh_value_null);
+  test_printf("exception: %s, live chunks: %li\n", exn != NULL ? exn->msg : "none", live_chunks());
+  if (exn != NULL) lh_exception_free(exn);
+
+  lh_try(&exn, huge, lh_value_null);
+  test_printf("huge: %s, live chunks: %li\n", exn != NULL && exn->code == ENOMEM ? "out of memory" : "none", live_chunks());
+  if (exn != NULL) lh_exception_free(exn);
+
+  int x = lh_int_value(lh_handle(&twice_def, lh_value_null, picking, lh_value_int(0)));
+  test_printf("picked: %i, live chunks: %li\n", x, live_chunks());
+  lh_register_thread_malloc(NULL, NULL, NULL, NULL);
+}
+
+void test_region() {
+  test("regions", run,
+    "nested: 4, live chunks: 0\n"
+    "exception: region aborted, live chunks: 0\n"
+    "huge: out of memory, live chunks: 0\n"
+    "picked: 23, live chunks: 0\n"
+  );
+}
@@ -0,0 +1,137 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+#include <string.h>
+
+/*-----------------------------------------------------------------
+  Tasks that hold a pointer to an object on their stack while they
+  are paused; a conservative collector should find them.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(gc, pause)
+LH_DEFINE_OP1(gc, pause, int, int)
+
+#define TASKS (6)
+static lh_resume paused[TASKS];
+static int count;
+
+static long objects[TASKS];  // the "heap" objects
+static long handler_object;  // held by the handler
+
+static lh_value _gc_pause(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  paused[count++] = r;
+  return arg;
+}
+
+static const lh_operation _gc_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(gc,pause), &_gc_pause },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef gc_def = { LH_EFFECT(gc), NULL, NULL, NULL, _gc_ops };
+
+static lh_value task(lh_value arg) {
+  long* volatile obj = &objects[lh_int_value(arg)];
+  *obj = lh_int_value(arg);
+  int x = gc_pause(lh_int_value(arg));
+  return lh_value_long(*obj + x);
+}
+
+/*-----------------------------------------------------------------
+  Scan the roots
+-----------------------------------------------------------------*/
+typedef struct _scan {
+  int    found[TASKS];
+  bool   found_local;
+  long   locals;
+  size_t cstack;
+} scan;
+
+static void scan_root(lh_rootkind kind, const void* start, size_t size, void* arg) {
+  scan* sc = (scan*)arg;
+  if (kind == LH_ROOT_LOCAL) {
+    sc->locals++;
+    if (size == sizeof(lh_value) && lh_ptr_value(*(const lh_value*)start) == (void*)&handler_object) sc->found_local = true;
+    return;
+  }
+  sc->cstack += size;
+  const char* p;
+  for (p = (const char*)start; p + sizeof(void*) <= (const char*)start + size; p += sizeof(void*)) {
+    void* v;
+    memcpy(&v, p, sizeof(void*));
+    int i;
+    for (i = 0; i < TASKS; i++) {
+      if (v == (void*)&objects[i]) sc->found[i]++;
+    }
+  }
+}
+
+static int found_all(const scan* sc) {
+  int n = 0;
+  int i;
+  for (i = 0; i < TASKS; i++) {
+    if (sc->found[i] > 0) n++;
+  }
+  return n;
+}
+
+static bool count_compressed(const lh_resume_info* info, void* arg) {
+  if (info->compressed || info->spilled) (*(long*)arg)++;
+  return true;
+}
+
+static long compressed(void) {
+  long n = 0;
+  lh_enum_resumptions(&count_compressed, &n);
+  return n;
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static void run() {
+  count = 0;
+  lh_set_compress_threshold(2);
+  int i;
+  for (i = 0; i < TASKS; i++) {
+    lh_handle(&gc_def, lh_value_any_ptr(&handler_object), task, lh_value_int(i));
+  }
+  // compressed resumptions are scanned without decompressing them
+  long cold = compressed();
+  scan sc;
+  memset(&sc, 0, sizeof(sc));
+  lh_enum_roots(&scan_root, &sc);
+  test_printf("found: %i, handler local: %s, still compressed: %s\n", found_all(&sc), sc.found_local ? "true" : "false",
+              cold > 0 && compressed() == cold ? "true" : "false");
+
+  // a clone shares its captured stack: only its handler local is new
+  lh_resume c = lh_resume_clone(paused[0]);
+  scan before = sc;
+  memset(&sc, 0, sizeof(sc));
+  lh_enum_roots(&scan_root, &sc);
+  test_printf("found: %i, shared once: %s\n", found_all(&sc), 
+              sc.cstack == before.cstack && sc.locals == before.locals + 1 ? "true" : "false");
+
+  long sum = 0;
+  for (i = 0; i < count; i++) {
+    sum += lh_long_value(lh_release_resume(paused[i], lh_value_null, lh_value_int(1)));
+  }
+  sum += lh_long_value(lh_release_resume(c, lh_value_null, lh_value_int(1)));
+  lh_set_compress_threshold(0);
+  memset(&sc, 0, sizeof(sc));
+  lh_enum_roots(&scan_root, &sc);
+  test_printf("sum: %li, found after resume: %i\n", sum, found_all(&sc));
+}
+
+void test_roots() {
+  test("enumerate roots", run,
+    "found: 6, handler local: true, still compressed: true\n"
+    "found: 6, shared once: true\n"
+    "sum: 22, found after resume: 0\n"
+  );
+}
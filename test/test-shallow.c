@@ -0,0 +1,180 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+/*-----------------------------------------------------------------
+  Generators
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(gen, yield)
+LH_DEFINE_VOIDOP1(gen, yield, int)
+
+static lh_value produce(lh_value arg) {
+  int n = lh_int_value(arg);
+  int i;
+  for (i = 0; i < n; i++) {
+    gen_yield(i);
+  }
+  return lh_value_null;
+}
+
+/*-----------------------------------------------------------------
+  Step-wise generator handlers: the `yield` operation returns from
+  the handler with the current element in `gen_step`.
+-----------------------------------------------------------------*/
+
+typedef struct _gen_step {
+  int       value;
+  lh_resume resume;
+  bool      done;
+} gen_step;
+
+static lh_value _gen_step_yield(lh_resume r, lh_value local, lh_value arg) {
+  gen_step* st = (gen_step*)lh_ptr_value(local);
+  st->value = lh_int_value(arg);
+  st->resume = r;
+  return lh_value_null;
+}
+
+static lh_value _gen_step_result(lh_value local, lh_value arg) {
+  gen_step* st = (gen_step*)lh_ptr_value(local);
+  st->done = true;
+  st->resume = NULL;
+  return arg;
+}
+
+static const lh_operation _gen_deep_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(gen,yield), &_gen_step_yield },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef gen_deep_def = { LH_EFFECT(gen), NULL, NULL, &_gen_step_result, _gen_deep_ops };
+
+static const lh_operation _gen_shallow_ops[] = {
+  { LH_OP_SHALLOW, LH_OPTAG(gen,yield), &_gen_step_yield },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef gen_shallow_def = { LH_EFFECT(gen), NULL, NULL, &_gen_step_result, _gen_shallow_ops };
+
+// A deep handler is restored on every resume
+int gen_sum_deep(int n) {
+  gen_step st = { 0, NULL, false };
+  lh_handle(&gen_deep_def, lh_value_any_ptr(&st), produce, lh_value_int(n));
+  int sum = 0;
+  while (!st.done) {
+    sum += st.value;
+    lh_release_resume(st.resume, lh_value_any_ptr(&st), lh_value_null);
+  }
+  return sum;
+}
+
+// A shallow handler is not part of the resumption; we resume each step under a new handler
+int gen_sum_shallow(int n) {
+  gen_step st = { 0, NULL, false };
+  lh_handle(&gen_shallow_def, lh_value_any_ptr(&st), produce, lh_value_int(n));
+  int sum = 0;
+  while (!st.done) {
+    sum += st.value;
+    lh_release_resume_with(st.resume, &gen_shallow_def, lh_value_any_ptr(&st), lh_value_null);
+  }
+  return sum;
+}
+
+/*-----------------------------------------------------------------
+  After a shallow resume, the outer handler handles the operations
+-----------------------------------------------------------------*/
+
+static lh_value _outer_yield(lh_resume r, lh_value local, lh_value arg) {
+  test_printf("outer: %i\n", lh_int_value(arg));
+  return lh_tail_resume(r, local, lh_value_null);
+}
+
+static lh_value _inner_yield(lh_resume r, lh_value local, lh_value arg) {
+  test_printf("inner: %i\n", lh_int_value(arg));
+  return lh_release_resume(r, local, lh_value_null);
+}
+
+static const lh_operation _outer_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(gen,yield), &_outer_yield },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef outer_def = { LH_EFFECT(gen), NULL, NULL, NULL, _outer_ops };
+
+static const lh_operation _inner_ops[] = {
+  { LH_OP_SHALLOW, LH_OPTAG(gen,yield), &_inner_yield },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef inner_def = { LH_EFFECT(gen), NULL, NULL, NULL, _inner_ops };
+
+static lh_value inner_produce(lh_value arg) {
+  return lh_handle(&inner_def, lh_value_null, produce, arg);
+}
+
+// Resume the rest of a generator under a different handler
+static void gen_switch(int n) {
+  gen_step st = { 0, NULL, false };
+  lh_handle(&gen_shallow_def, lh_value_any_ptr(&st), produce, lh_value_int(n));
+  test_printf("first: %i\n", st.value);
+  lh_release_resume_with(st.resume, &outer_def, lh_value_null, lh_value_null);
+}
+
+/*-----------------------------------------------------------------
+  The local state of a shallow handler is released only after
+  its operation is done with it
+-----------------------------------------------------------------*/
+
+static int box_releases;
+
+static void _box_release(lh_value local) {
+  unreferenced(local);
+  box_releases++;
+}
+
+static lh_value _box_yield(lh_resume r, lh_value local, lh_value arg) {
+  test_printf("box %i: released %i\n", *(int*)lh_ptr_value(local) + lh_int_value(arg), box_releases);
+  lh_release(r);
+  return lh_value_null;
+}
+
+static const lh_operation _box_ops[] = {
+  { LH_OP_SHALLOW, LH_OPTAG(gen,yield), &_box_yield },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef box_def = { LH_EFFECT(gen), NULL, &_box_release, NULL, _box_ops };
+
+static void box_produce(void) {
+  int box = 40;
+  box_releases = 0;
+  lh_handle(&box_def, lh_value_any_ptr(&box), produce, lh_value_int(3));
+  test_printf("box released: %i\n", box_releases);
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static void run() {
+  lh_handle(&outer_def, lh_value_null, inner_produce, lh_value_int(3));
+  test_printf("sum deep: %i\n", gen_sum_deep(5));
+  test_printf("sum shallow: %i\n", gen_sum_shallow(5));
+  gen_switch(3);
+  box_produce();
+}
+
+void test_shallow() {
+  test("shallow handlers", run,
+    "inner: 0\n"
+    "outer: 1\n"
+    "outer: 2\n"
+    "sum deep: 10\n"
+    "sum shallow: 10\n"
+    "first: 0\n"
+    "outer: 1\n"
+    "outer: 2\n"
+    "box 40: released 0\n"
+    "box released: 1\n"
+  );
+}
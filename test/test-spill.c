@@ -0,0 +1,86 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+#include <stdlib.h>
+
+/*-----------------------------------------------------------------
+  Park continuations that wait on a value; when the captured
+  stacks exceed the budget they are spilled to a file and moved 
+  back into memory when resumed.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(aio, wait)
+LH_DEFINE_OP1(aio, wait, int, int)
+
+#define PARKED (100)
+static lh_resume parked[PARKED];
+
+static lh_value _aio_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  parked[lh_int_value(arg)] = r;
+  return lh_value_int(-1);
+}
+
+static const lh_operation _aio_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(aio,wait), &_aio_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef aio_def = { LH_EFFECT(aio), NULL, NULL, NULL, _aio_ops };
+
+// use some stack with local state that must survive compression
+static int waiter(int depth, int id) {
+  volatile int frame[64];
+  int i;
+  for (i = 0; i < 64; i++) frame[i] = (i % 3 == 0 ? id * i : 0);
+  int x = (depth > 0 ? waiter(depth - 1, id) : aio_wait(id));
+  int sum = 0;
+  for (i = 0; i < 64; i++) sum += frame[i];
+  return x + sum;
+}
+
+static lh_value request(lh_value arg) {
+  return lh_value_int(waiter(3, lh_int_value(arg)));
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static long resume_all(void) {
+  long sum = 0;
+  int i;
+  for (i = 0; i < PARKED; i++) {
+    sum += lh_int_value(lh_release_resume(parked[i], lh_value_null, lh_value_int(i)));
+  }
+  return sum;
+}
+
+static void run() {
+  lh_stats st0, st1;
+  lh_get_stats(&st0);
+  const char* dir = getenv("TMPDIR");
+  bool supported = lh_set_spill_store(dir != NULL ? dir : "/tmp", 4096);
+  int i;
+  for (i = 0; i < PARKED; i++) {
+    lh_handle(&aio_def, lh_value_null, request, lh_value_int(i));
+  }
+  // cloning a spilled continuation works too
+  lh_resume c = lh_resume_clone(parked[0]);
+  long sum = resume_all();
+  int x = lh_int_value(lh_release_resume(c, lh_value_null, lh_value_int(1)));
+  lh_set_spill_store(NULL, 0);
+  lh_get_stats(&st1);
+  test_printf("sum: %li, clone: %i\n", sum, x);
+  test_printf("spilled: %s\n", !supported || st1.spilled - st0.spilled >= PARKED / 2 ? "true" : "false");
+}
+
+void test_spill() {
+  test("spill cold resumptions", run,
+    "sum: 13726350, clone: 1\n"
+    "spilled: true\n"
+  );
+}
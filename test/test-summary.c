@@ -0,0 +1,183 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+/*-----------------------------------------------------------------
+  Lookups use the effect summary of each handler frame to stop
+  as soon as the rest of the handler stack cannot handle an effect.
+-----------------------------------------------------------------*/
+
+// the outer handler answers with its local state
+LH_DEFINE_EFFECT1(outer, ask)
+LH_DEFINE_OP0(outer, ask, int)
+
+static lh_value _outer_ask(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, local, local);
+}
+
+static const lh_operation _outer_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(outer,ask), &_outer_ask },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef outer_def = { LH_EFFECT(outer), NULL, NULL, NULL, _outer_ops };
+
+// the relay handler also answers with its local state
+LH_DEFINE_EFFECT1(relay, get)
+LH_DEFINE_OP0(relay, get, int)
+
+static lh_value _relay_get(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, local, local);
+}
+
+static const lh_operation _relay_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(relay,get), &_relay_get },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef relay_def = { LH_EFFECT(relay), NULL, NULL, NULL, _relay_ops };
+
+// handlers without operations that make the handler stack deep
+LH_DEFINE_EFFECT0(noise)
+
+static const lh_operation _noise_ops[] = {
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef noise_def = { LH_EFFECT(noise), NULL, NULL, NULL, _noise_ops };
+
+// effects that are never handled
+LH_DEFINE_EFFECT1(absent1, op)
+LH_DEFINE_EFFECT1(absent2, op)
+LH_DEFINE_EFFECT1(absent3, op)
+LH_DEFINE_EFFECT1(absent4, op)
+
+// the inner handler asks the outer handler from its operation (through a skip frame)
+// and then resumes in place (on top of a fragment frame) where the resumption asks again
+LH_DEFINE_EFFECT1(inner, wait)
+LH_DEFINE_OP0(inner, wait, int)
+
+static lh_value _inner_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  int x = outer_ask();
+  lh_value res = lh_call_resume(r, local, lh_value_int(x));
+  lh_release(r);
+  return res;
+}
+
+static const lh_operation _inner_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(inner,wait), &_inner_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef inner_def = { LH_EFFECT(inner), NULL, NULL, NULL, _inner_ops };
+
+// the stash handler keeps the resumption to resume it later under other handlers
+LH_DEFINE_EFFECT1(stash, wait)
+LH_DEFINE_OP0(stash, wait, int)
+
+static lh_resume parked;
+
+static lh_value _stash_wait(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(local);
+  unreferenced(arg);
+  parked = r;
+  return lh_value_int(0);
+}
+
+static const lh_operation _stash_ops[] = {
+  { LH_OP_GENERAL, LH_OPTAG(stash,wait), &_stash_wait },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef stash_def = { LH_EFFECT(stash), NULL, NULL, NULL, _stash_ops };
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+#define DEPTH (32)
+
+// a lookup of an effect that is not handled anywhere
+static long miss_frames(lh_optag optag, bool* found) {
+  lh_stats st0, st1;
+  lh_get_stats(&st0);
+  if (lh_has_handler(optag)) *found = true;
+  lh_get_stats(&st1);
+  return (st1.lookup_frames - st0.lookup_frames);
+}
+
+static lh_value misses(lh_value arg) {
+  unreferenced(arg);
+  bool found = false;
+  long least = DEPTH;
+  lh_optag optags[4] = { LH_OPTAG(absent1,op), LH_OPTAG(absent2,op), LH_OPTAG(absent3,op), LH_OPTAG(absent4,op) };
+  int i;
+  for (i = 0; i < 4; i++) {
+    long n = miss_frames(optags[i], &found);
+    if (n < least) least = n;
+  }
+  // summaries are a bloom filter so a miss can visit more frames, but not for all four effects
+  test_printf("found: %s, least frames visited: %li\n", found ? "true" : "false", least);
+  return lh_value_int(outer_ask());
+}
+
+static lh_value nest(lh_value arg) {
+  int n = lh_int_value(arg);
+  if (n > 0) return lh_handle(&noise_def, lh_value_null, nest, lh_value_int(n - 1));
+  return misses(lh_value_null);
+}
+
+static lh_value waiting(lh_value arg) {
+  unreferenced(arg);
+  int x = inner_wait();
+  return lh_value_int(x + outer_ask());
+}
+
+static lh_value noisy_waiting(lh_value arg) {
+  int n = lh_int_value(arg);
+  if (n > 0) return lh_handle(&noise_def, lh_value_null, noisy_waiting, lh_value_int(n - 1));
+  return lh_handle(&inner_def, lh_value_null, waiting, lh_value_null);
+}
+
+static lh_value parking(lh_value arg) {
+  unreferenced(arg);
+  int x = stash_wait();
+  // resumed under the relay handler instead of the outer one
+  bool outer = lh_has_handler(LH_OPTAG(outer,ask));
+  return lh_value_int(outer ? -1 : x + relay_get());
+}
+
+static lh_value park_under_outer(lh_value arg) {
+  return lh_handle(&stash_def, lh_value_null, parking, arg);
+}
+
+static lh_value resume_parked(lh_value arg) {
+  return lh_release_resume(parked, lh_value_null, arg);
+}
+
+static void run() {
+  // a miss stops at the top frame
+  int x = lh_int_value(lh_handle(&outer_def, lh_value_int(10), nest, lh_value_int(DEPTH)));
+  test_printf("outer: %i\n", x);
+
+  // hits through skip and fragment frames
+  x = lh_int_value(lh_handle(&outer_def, lh_value_int(10), noisy_waiting, lh_value_int(4)));
+  test_printf("asked twice: %i\n", x);
+
+  // resuming moves the handler frames onto another handler stack and recomputes their summaries
+  lh_handle(&outer_def, lh_value_int(10), park_under_outer, lh_value_null);
+  x = lh_int_value(lh_handle(&relay_def, lh_value_int(5), resume_parked, lh_value_int(1)));
+  test_printf("resumed under relay: %i\n", x);
+}
+
+void test_summary() {
+  test("effect summaries", run,
+    "found: false, least frames visited: 1\n"
+    "outer: 10\n"
+    "asked twice: 20\n"
+    "resumed under relay: 6\n"
+  );
+}
@@ -0,0 +1,70 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+/*-----------------------------------------------------------------
+  A long running outer handler with a spike of deeply nested 
+  handlers; the handler stack shrinks again afterwards.
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(nest, depth)
+LH_DEFINE_OP0(nest, depth, int)
+
+static lh_value _nest_depth(lh_resume r, lh_value local, lh_value arg) {
+  unreferenced(arg);
+  return lh_tail_resume(r, local, local);
+}
+
+static const lh_operation _nest_ops[] = {
+  { LH_OP_TAIL, LH_OPTAG(nest,depth), &_nest_depth },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef nest_def = { LH_EFFECT(nest), NULL, NULL, NULL, _nest_ops };
+
+static lh_value nested(lh_value arg) {
+  int n = lh_int_value(arg);
+  if (n <= 0) return lh_value_int(nest_depth());
+  return lh_handle(&nest_def, lh_value_int(n), nested, lh_value_int(n - 1));
+}
+
+static ptrdiff_t hstack_size(void) {
+  lh_stats st;
+  lh_get_stats(&st);
+  return st.hstack_size;
+}
+
+static lh_value server(lh_value arg) {
+  unreferenced(arg);
+  ptrdiff_t size0 = hstack_size();
+  // a spike of nested handlers
+  int x = lh_int_value(nested(lh_value_int(1000)));
+  lh_stats st;
+  lh_get_stats(&st);
+  test_printf("depth: %i, grown: %s, shrunk: %s\n", x, st.hstack_peak > size0 ? "true" : "false", 
+               st.hstack_size < st.hstack_peak ? "true" : "false");
+  // and trim explicitly
+  lh_hstack_trim();
+  test_printf("trimmed: %s\n", hstack_size() <= st.hstack_size ? "true" : "false");
+  return lh_value_int(nest_depth());
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static void run() {
+  int x = lh_int_value(lh_handle(&nest_def, lh_value_int(42), server, lh_value_null));
+  test_printf("outer: %i\n", x);
+}
+
+void test_trim() {
+  test("shrink the handler stack", run,
+    "depth: 1, grown: true, shrunk: true\n"
+    "trimmed: true\n"
+    "outer: 42\n"
+  );
+}
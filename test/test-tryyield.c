@@ -0,0 +1,76 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+/*-----------------------------------------------------------------
+  An optional logging effect: only logs if a handler is installed
+-----------------------------------------------------------------*/
+LH_DEFINE_EFFECT1(logger, msg)
+
+static void logger_msg(const char* msg) {
+  if (!lh_try_yield(LH_OPTAG(logger, msg), lh_value_lh_string(msg), NULL)) {
+    test_printf("(no logger)\n");
+  }
+}
+
+static lh_value _logger_msg(lh_resume r, lh_value local, lh_value arg) {
+  test_printf("log: %s\n", lh_lh_string_value(arg));
+  return lh_tail_resume(r, local, lh_value_null);
+}
+
+static const lh_operation _logger_ops[] = {
+  { LH_OP_TAIL_NOOP, LH_OPTAG(logger,msg), &_logger_msg },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef logger_def = { LH_EFFECT(logger), NULL, NULL, NULL, _logger_ops };
+
+static lh_value logger_handle(lh_value(*action)(lh_value), lh_value arg) {
+  return lh_handle(&logger_def, lh_value_null, action, arg);
+}
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static lh_value count_logged(lh_value arg) {
+  unreferenced(arg);
+  int i;
+  while ((i = state_get()) > 0) {
+    logger_msg("count");
+    state_put(i - 1);
+  }
+  return lh_value_bool(lh_has_handler(LH_OPTAG(logger, msg)));
+}
+
+static lh_value state_count_logged(lh_value arg) {
+  return state_handle(count_logged, 2, arg);
+}
+
+static void run() {
+  test_printf("has logger: %s\n", lh_has_handler(LH_OPTAG(logger, msg)) ? "true" : "false");
+  lh_value res1 = state_count_logged(lh_value_null);
+  test_printf("test res1: %s\n", lh_bool_value(res1) ? "true" : "false");
+  lh_value res2 = logger_handle(state_count_logged, lh_value_null);
+  test_printf("test res2: %s\n", lh_bool_value(res2) ? "true" : "false");
+  lh_value res3;
+  bool yielded = lh_try_yield(LH_OPTAG(state, get), lh_value_null, &res3);
+  test_printf("test res3: %s\n", yielded ? "true" : "false");
+}
+
+void test_tryyield() {
+  test("try yield", run,
+    "has logger: false\n"
+    "(no logger)\n"
+    "(no logger)\n"
+    "test res1: false\n"
+    "log: count\n"
+    "log: count\n"
+    "test res2: true\n"
+    "test res3: false\n"
+  );
+}
@@ -0,0 +1,79 @@
+/* ----------------------------------------------------------------------------
+Copyright (c) 2016, Microsoft Research, Daan Leijen
+This is free software; you can redistribute it and/or modify it under the
+terms of the Apache License, Version 2.0. A copy of the License can be
+found in the file "license.txt" at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "libhandler.h"
+#include "tests.h"
+
+/*-----------------------------------------------------------------
+  A state handler that forwards `get` to the handler below
+-----------------------------------------------------------------*/
+
+static lh_value _fwd_put(lh_resume rc, lh_value local, lh_value arg) {
+  return lh_tail_resume(rc, arg, lh_value_null);
+}
+
+static const lh_operation _fwd_ops[] = {
+  { LH_OP_FORWARD, LH_OPTAG(state,get), NULL },
+  { LH_OP_TAIL_NOOP, LH_OPTAG(state,put), &_fwd_put },
+  { LH_OP_NULL, lh_op_null, NULL }
+};
+static const lh_handlerdef fwd_def = { LH_EFFECT(state), NULL, NULL, NULL, _fwd_ops };
+
+/*-----------------------------------------------------------------
+  Test programs
+-----------------------------------------------------------------*/
+
+static lh_handlerref outer;
+static lh_handlerref middle;
+
+static int outer_get() {
+  return lh_int_value(lh_yield_to(outer, LH_OPTAG(state, get), lh_value_null));
+}
+
+static lh_value inner_action(lh_value arg) {
+  unreferenced(arg);
+  test_printf("inner get: %i, outer get: %i\n", state_get(), outer_get());
+  lh_yield_to(outer, LH_OPTAG(state, put), lh_value_int(outer_get() + 1));
+  test_printf("inner get: %i, outer get: %i\n", state_get(), outer_get());
+  // a stale hint falls back to a search
+  lh_handlerref stale = outer;
+  stale.hint = -1;
+  test_printf("stale get: %i\n", lh_int_value(lh_yield_to(stale, LH_OPTAG(state, get), lh_value_null)));
+  // yield to a handler that forwards the operation
+  test_printf("forward get: %i\n", lh_int_value(lh_yield_to(middle, LH_OPTAG(state, get), lh_value_null)));
+  return lh_value_int(state_get());
+}
+
+static lh_value middle_action(lh_value arg) {
+  middle = lh_find_handler(LH_EFFECT(state));
+  return state_handle(inner_action, 1, arg);
+}
+
+static lh_value outer_action(lh_value arg) {
+  outer = lh_find_handler(LH_EFFECT(state));
+  lh_value res = lh_handle(&fwd_def, lh_value_int(0), middle_action, arg);
+  test_printf("outer get: %i\n", state_get());
+  return res;
+}
+
+static void run() {
+  lh_handlerref none = lh_find_handler(LH_EFFECT(state));
+  test_printf("no handler: %s\n", none.id == 0 ? "true" : "false");
+  lh_value res = state_handle(outer_action, 10, lh_value_null);
+  test_printf("test res: %i\n", lh_int_value(res));
+}
+
+void test_yieldto() {
+  test("yield to", run,
+    "no handler: true\n"
+    "inner get: 1, outer get: 10\n"
+    "inner get: 1, outer get: 11\n"
+    "stale get: 11\n"
+    "forward get: 11\n"
+    "outer get: 11\n"
+    "test res: 1\n"
+  );
+}
@@ -90,6 +90,27 @@ void test_tailops();
 void test_state_alloc();
 void test_yieldn();
 void test_exn();  // builtin exceptions
+void test_tryyield();
+void test_default();
+void test_yieldto();
+void test_multi();
+void test_shallow();
+void test_localref();
+void test_cell();
+void test_clone();
+void test_compress();
+void test_spill();
+void test_dedup();
+void test_budget();
+void test_arena();
+void test_trim();
+void test_alloc();
+void test_region();
+void test_embed();
+void test_roots();
+void test_summary();
+int  gen_sum_deep(int n);
+int  gen_sum_shallow(int n);
 
 /*-----------------------------------------------------------------
   List of lh_value's; Declared in tests_amb